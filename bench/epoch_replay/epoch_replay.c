@@ -0,0 +1,288 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.  
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+
+// Replays epoch logs recorded with latency.epoch_log through the latency
+// model with other parameters and projects the runtime of each thread.
+//
+// usage: epoch_replay [-r read_ns[,read_ns...]] [-w write_ns] [-f l3_factor] [-m on|off] log...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#define EPOCH_LOG_FORMAT_ONLY
+#include "epoch_log.h"
+#include "model_lat.h"
+
+#define MAX_READ_LATENCIES 16
+
+enum {
+    L2_PENDING,
+    LLC_HIT,
+    REMOTE_DRAM,
+    LOCAL_DRAM,
+    L2_DIRTY,
+    OUTSTANDING,
+    OUTSTANDING_CYCLES,
+    NUM_ROLES
+};
+
+// counters the derived events of each processor are computed from, see src/lib/cpu
+static const struct {
+    const char* name;
+    int role;
+} known_counters[] = {
+    { "CYCLE_ACTIVITY:STALLS_L2_PENDING", L2_PENDING },
+    { "MEM_LOAD_UOPS_LLC_HIT_RETIRED:XSNP_NONE", LLC_HIT },
+    { "MEM_LOAD_UOPS_L3_HIT_RETIRED:XSNP_NONE", LLC_HIT },
+    { "MEM_LOAD_UOPS_RETIRED:L3_HIT", LLC_HIT },
+    { "MEM_LOAD_UOPS_LLC_MISS_RETIRED:REMOTE_DRAM", REMOTE_DRAM },
+    { "MEM_LOAD_UOPS_L3_MISS_RETIRED:REMOTE_DRAM", REMOTE_DRAM },
+    { "MEM_LOAD_UOPS_LLC_MISS_RETIRED:LOCAL_DRAM", LOCAL_DRAM },
+    { "MEM_LOAD_UOPS_L3_MISS_RETIRED:LOCAL_DRAM", LOCAL_DRAM },
+    { "MEM_LOAD_UOPS_MISC_RETIRED:LLC_MISS", LOCAL_DRAM },
+    { "L2_LINES_OUT:DIRTY_ALL", L2_DIRTY },
+    { "L2_LINES_OUT:DEMAND_DIRTY", L2_DIRTY },
+    { "OFFCORE_REQUESTS_OUTSTANDING:DEMAND_DATA_RD", OUTSTANDING },
+    { "OFFCORE_REQUESTS_OUTSTANDING:CYCLES_WITH_DEMAND_DATA_RD", OUTSTANDING_CYCLES },
+    { NULL, 0 }
+};
+
+typedef struct {
+    int read_latencies[MAX_READ_LATENCIES]; // 0 entries means the recorded one
+    int num_read_latencies;
+    int write_latency; // 0 means the recorded one
+    int l3_factor;
+    int mlp; // -1 as recorded, 0 off, 1 on
+} replay_params_t;
+
+// Parses a positive number up to the first separator, *end points past it
+static int parse_positive(const char* str, char separator, int* value, const char** end)
+{
+    char* p;
+    long n;
+
+    n = strtol(str, &p, 10);
+    if (p == str || n <= 0 || n > INT_MAX || (*p && *p != separator)) {
+        return -1;
+    }
+    *value = (int) n;
+    *end = *p ? p + 1 : p;
+    return 0;
+}
+
+static int parse_latencies(const char* str, replay_params_t* params)
+{
+    while (*str) {
+        if (params->num_read_latencies == MAX_READ_LATENCIES ||
+                parse_positive(str, ',', &params->read_latencies[params->num_read_latencies], &str) != 0) {
+            return -1;
+        }
+        params->num_read_latencies++;
+    }
+    return 0;
+}
+
+static void map_counters(const epoch_log_header_t* header, int roles[NUM_ROLES])
+{
+    int i, j;
+
+    for (i = 0; i < NUM_ROLES; i++) {
+        roles[i] = -1;
+    }
+    for (i = 0; i < EPOCH_LOG_MAX_COUNTERS; i++) {
+        for (j = 0; known_counters[j].name; j++) {
+            if (strncmp(header->counter_names[i], known_counters[j].name, EPOCH_LOG_NAME_LEN) == 0) {
+                roles[known_counters[j].role] = i;
+            }
+        }
+    }
+}
+
+#define COUNT(record, roles, role) ((roles)[role] >= 0 ? (record)->counter_diffs[(roles)[role]] : 0)
+
+// Same formulas as the derived events of src/lib/cpu, see model_lat.h, with
+// the LLC hit weight as a parameter. Falls back to the recorded stall cycles
+// when the raw counts are missing.
+static uint64_t replay_stall_cycles(const epoch_log_header_t* header, const epoch_record_t* record,
+                                    const int roles[NUM_ROLES], int l3_factor)
+{
+    uint64_t remote_dram = COUNT(record, roles, REMOTE_DRAM);
+    uint64_t local_dram = COUNT(record, roles, LOCAL_DRAM);
+    uint64_t stalls;
+
+    if (roles[L2_PENDING] < 0 || roles[LLC_HIT] < 0 || (roles[REMOTE_DRAM] < 0 && roles[LOCAL_DRAM] < 0)) {
+        return record->stall_cycles;
+    }
+
+    stalls = llc_stall_cycles(COUNT(record, roles, L2_PENDING), remote_dram + local_dram,
+                              COUNT(record, roles, LLC_HIT), l3_factor);
+    if (header->remote_stalls) {
+        stalls = remote_stall_cycles(stalls, remote_dram, local_dram,
+                                     header->hw_remote_latency_ns, header->hw_local_latency_ns);
+    }
+    return stalls;
+}
+
+static uint64_t replay_writebacks(const epoch_record_t* record, const int roles[NUM_ROLES])
+{
+    if (roles[L2_DIRTY] < 0) {
+        return record->writebacks;
+    }
+    return llc_writebacks(COUNT(record, roles, L2_DIRTY),
+                          COUNT(record, roles, REMOTE_DRAM) + COUNT(record, roles, LOCAL_DRAM),
+                          COUNT(record, roles, LLC_HIT));
+}
+
+static uint64_t replay_memory_parallelism(const epoch_record_t* record, const int roles[NUM_ROLES], int mlp)
+{
+    if (mlp < 0) return record->memory_parallelism ? record->memory_parallelism : 1 << MLP_SHIFT;
+    if (mlp == 0) return 1 << MLP_SHIFT;
+    if (roles[OUTSTANDING] < 0 || roles[OUTSTANDING_CYCLES] < 0) {
+        return record->memory_parallelism ? record->memory_parallelism : 1 << MLP_SHIFT;
+    }
+    return memory_parallelism(COUNT(record, roles, OUTSTANDING), COUNT(record, roles, OUTSTANDING_CYCLES));
+}
+
+static int replay_file(const char* path, const replay_params_t* params)
+{
+    FILE* f;
+    epoch_log_header_t header;
+    epoch_record_t record;
+    int roles[NUM_ROLES];
+    int i, n;
+    int read_latency, write_latency, hw_latency;
+    uint64_t epochs = 0;
+    uint64_t duration_cycles = 0;
+    uint64_t recorded_delay_cycles = 0;
+    uint64_t delay_cycles[MAX_READ_LATENCIES];
+    uint64_t stall_cycles, writebacks, mlp;
+
+    if (!(f = fopen(path, "rb"))) {
+        perror(path);
+        return -1;
+    }
+    if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != EPOCH_LOG_MAGIC ||
+            header.version != EPOCH_LOG_VERSION || header.record_size != sizeof(epoch_record_t) ||
+            header.tsc_mhz <= 0 || header.cpu_speed_mhz <= 0 || header.hw_remote_latency_ns <= 0) {
+        fprintf(stderr, "%s: not an epoch log of this version\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    map_counters(&header, roles);
+    n = params->num_read_latencies ? params->num_read_latencies : 1;
+    memset(delay_cycles, 0, sizeof(delay_cycles));
+    hw_latency = header.hw_remote_latency_ns;
+    write_latency = params->write_latency ? params->write_latency : header.write_latency_ns;
+
+    while (fread(&record, sizeof(record), 1, f) == 1) {
+        epochs++;
+        if (record.end > record.start) {
+            duration_cycles += record.end - record.start;
+        }
+        recorded_delay_cycles += record.delay_cycles;
+
+        stall_cycles = replay_stall_cycles(&header, &record, roles, params->l3_factor);
+        writebacks = replay_writebacks(&record, roles);
+        mlp = replay_memory_parallelism(&record, roles, params->mlp);
+
+        for (i = 0; i < n; i++) {
+            read_latency = params->num_read_latencies ? params->read_latencies[i] : header.read_latency_ns;
+            delay_cycles[i] += overlapped_delay_cycles(read_delay_cycles(stall_cycles, delay_ratio(read_latency, hw_latency)), mlp);
+            delay_cycles[i] += writebacks * write_delay_cycles_per_line(header.cpu_speed_mhz, write_latency, hw_latency);
+        }
+    }
+    fclose(f);
+
+    printf("%s: thread %d cpu %d virtual node %d\n", path, header.tid, header.cpu_id, header.virtual_node_id);
+    printf("\tepochs: %lu\n", epochs);
+    printf("\trecorded duration without delays: %lu usecs\n", duration_cycles / header.tsc_mhz);
+    printf("\trecorded delay at %d ns: %lu usecs\n", header.read_latency_ns, recorded_delay_cycles / header.cpu_speed_mhz);
+    for (i = 0; i < n; i++) {
+        read_latency = params->num_read_latencies ? params->read_latencies[i] : header.read_latency_ns;
+        // epochs start once the delay of the previous one is over
+        printf("\tread %d ns write %d ns: delay %lu usecs, projected duration %lu usecs\n",
+               read_latency, write_latency, delay_cycles[i] / header.cpu_speed_mhz,
+               duration_cycles / header.tsc_mhz + delay_cycles[i] / header.cpu_speed_mhz);
+    }
+    return 0;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-r read_ns[,read_ns...]] [-w write_ns] [-f l3_factor] [-m on|off] log...\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    int i;
+    int status = 0;
+    const char* end;
+    replay_params_t params;
+
+    memset(&params, 0, sizeof(params));
+    params.l3_factor = L3_FACTOR;
+    params.mlp = -1;
+
+    while ((opt = getopt(argc, argv, "r:w:f:m:")) != -1) {
+        switch (opt) {
+            case 'r':
+                if (parse_latencies(optarg, &params) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'w':
+                if (parse_positive(optarg, '\0', &params.write_latency, &end) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'f':
+                if (parse_positive(optarg, '\0', &params.l3_factor, &end) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'm':
+                if (strcmp(optarg, "on") == 0) {
+                    params.mlp = 1;
+                } else if (strcmp(optarg, "off") == 0) {
+                    params.mlp = 0;
+                } else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (i = optind; i < argc; i++) {
+        if (replay_file(argv[i], &params) != 0) {
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -175,7 +175,8 @@ static long pmc_ioctl_setcounter(struct file* f, unsigned int cmd, unsigned long
         return -EFAULT;
     }
 
-	if ((q.counter_id < 0) || (q.counter_id > 3)) {
+	/* PERFEVTSEL4-7 only exist when hyperthreading is disabled, user space checks CPUID */
+	if ((q.counter_id < 0) || (q.counter_id > 7)) {
 		printk(KERN_INFO "%s: set_counter illegal value 0x%x for counter\n", module_name, q.counter_id);
         return -ENXIO;
     }
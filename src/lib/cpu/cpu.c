@@ -21,6 +21,7 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include "misc.h"
 #include "known_cpus.h"
 #include "xeon-ex.h"
+#include "pmc.h"
 #include <cpuid.h>
 
 // Mainline architectures and processors available here:
@@ -95,6 +96,34 @@ char *cpuinfo(char *valname)
     return NULL;
 }
 
+// number of general purpose performance counters per logical processor as
+// reported by the architectural performance monitoring leaf (CPUID.0AH:EAX[15:8]).
+// It is 4 on Sandy Bridge, Ivy Bridge and Haswell with hyperthreading enabled
+// and 8 otherwise.
+int cpu_num_hw_cntrs()
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid_max(0, NULL) < 0xA) {
+        return 0;
+    }
+    __cpuid(0xA, eax, ebx, ecx, edx);
+    return EXTRACT(eax, 15, 8);
+}
+
+// bit width of the general purpose performance counters (CPUID.0AH:EAX[23:16]),
+// rdpmc returns that many bits and the counters wrap around past them
+int cpu_hw_cntr_width()
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid_max(0, NULL) < 0xA) {
+        return 0;
+    }
+    __cpuid(0xA, eax, ebx, ecx, edx);
+    return EXTRACT(eax, 23, 16);
+}
+
 // reads current cpu frequency through the /proc/cpuinfo file
 // avoid calling this function often
 int cpu_speed_mhz()
@@ -183,6 +212,27 @@ int is_Intel()
     }
 }
 
+// complete the model with some runtime information
+static void complete_cpu_model(cpu_model_t *cpu_model)
+{
+    int num_hw_cntrs;
+    int hw_cntr_width;
+
+    cpu_model->llc_size_bytes = cpu_llc_size_bytes();
+    if ((num_hw_cntrs = cpu_num_hw_cntrs()) > 0) {
+        if (num_hw_cntrs > PMC_MAX_HW_CNTRS) {
+            num_hw_cntrs = PMC_MAX_HW_CNTRS;
+        }
+        cpu_model->pmc_events->num_avail_hw_cntrs = num_hw_cntrs;
+    }
+    if ((hw_cntr_width = cpu_hw_cntr_width()) > 0 && hw_cntr_width < 64) {
+        cpu_model->pmc_events->hw_cntr_mask = (1ULL << hw_cntr_width) - 1;
+    }
+    DBG_LOG(INFO, "%d general purpose performance counters available, %d bits wide\n",
+            cpu_model->pmc_events->num_avail_hw_cntrs, hw_cntr_width);
+    //    cpu_model->speed_mhz = cpu_speed_mhz();
+}
+
 cpu_model_t *cpu_model()
 {
     int i, family, model;
@@ -229,9 +279,44 @@ cpu_model_t *cpu_model()
         return NULL;
     }
 
-    // complete the model with some runtime information
-    cpu_model->llc_size_bytes = cpu_llc_size_bytes();
-    //    cpu_model->speed_mhz = cpu_speed_mhz();
+    complete_cpu_model(cpu_model);
+    return cpu_model;
+}
+
+// The processor simulated by simulation.cpu, named as in microarch_strings
+cpu_model_t *cpu_model_by_name(const char *name)
+{
+    int microarch;
+    cpu_model_t *cpu_model;
+
+    for (microarch = SandyBridge; microarch <= HaswellXeon; microarch++)
+    {
+        if (strcasecmp(name, microarch_strings[microarch]) == 0)
+            break;
+    }
+
+    switch (microarch)
+    {
+    case SandyBridge:
+    case SandyBridgeXeon:
+        cpu_model = &cpu_model_intel_xeon_ex;
+        break;
+    case IvyBridge:
+    case IvyBridgeXeon:
+        cpu_model = &cpu_model_intel_xeon_ex_v2;
+        break;
+    case Haswell:
+    case HaswellXeon:
+        cpu_model = &cpu_model_intel_xeon_ex_v3;
+        break;
+    default:
+        DBG_LOG(ERROR, "Unknown processor '%s'\n", name);
+        return NULL;
+    }
+
+    cpu_model->microarch = (microarch_t) microarch;
+    DBG_LOG(INFO, "Simulating CPU model '%s'\n", microarch_strings[cpu_model->microarch]);
 
+    complete_cpu_model(cpu_model);
     return cpu_model;
 }
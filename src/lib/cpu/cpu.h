@@ -63,6 +63,9 @@ typedef struct cpu_model_s {
 } cpu_model_t;
 
 cpu_model_t* cpu_model();
+cpu_model_t* cpu_model_by_name(const char* name);
 int cpu_speed_mhz();
+int cpu_num_hw_cntrs();
+int cpu_hw_cntr_width();
 
 #endif /* __CPU_H */
@@ -14,7 +14,6 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #ifndef __CPU_IVYBRIDGE_H
 #define __CPU_IVYBRIDGE_H
 
-#include <math.h>
 #include "thread.h"
 #include "cpu/pmc.h"
 #include "debug.h"
@@ -27,6 +26,7 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 
 extern __thread int tls_hw_local_latency;
 extern __thread int tls_hw_remote_latency;
+extern __thread uint64_t tls_nvm_line_reads;
 #ifdef MEMLAT_SUPPORT
 extern __thread uint64_t tls_global_remote_dram;
 extern __thread uint64_t tls_global_local_dram;
@@ -37,16 +37,19 @@ extern __thread uint64_t tls_global_local_dram;
   ACTION("CYCLE_ACTIVITY:STALLS_L2_PENDING", NULL, 0x55305a3)                                              \
   ACTION("MEM_LOAD_UOPS_LLC_HIT_RETIRED:XSNP_NONE", NULL, 0x5308d2)                                        \
   ACTION("MEM_LOAD_UOPS_LLC_MISS_RETIRED:REMOTE_DRAM", NULL, 0x530cd3)                                     \
-  ACTION("MEM_LOAD_UOPS_LLC_MISS_RETIRED:LOCAL_DRAM", NULL, 0x5303d3)
+  ACTION("MEM_LOAD_UOPS_LLC_MISS_RETIRED:LOCAL_DRAM", NULL, 0x5303d3)                                      \
+  ACTION("L2_LINES_OUT:DIRTY_ALL", NULL, 0x530af2)                                                         \
+  ACTION("OFFCORE_REQUESTS_OUTSTANDING:DEMAND_DATA_RD", NULL, 0x530160)                                    \
+  ACTION("OFFCORE_REQUESTS_OUTSTANDING:CYCLES_WITH_DEMAND_DATA_RD", NULL, 0x1530160)
 
 #undef FOREACH_PMC_EVENT
 #define FOREACH_PMC_EVENT(ACTION, prefix)                                                                  \
   ACTION(ldm_stall_cycles, prefix)                                                                         \
-  ACTION(remote_dram, prefix)
+  ACTION(remote_dram, prefix)                                                                              \
+  ACTION(dram_writebacks, prefix)                                                                          \
+  ACTION(memory_parallelism, prefix)
 
 
-#define L3_FACTOR 7.0
-
 DECLARE_ENABLE_PMC(ivybridge, ldm_stall_cycles)
 {
     ASSIGN_PMC_HW_EVENT_TO_ME("CYCLE_ACTIVITY:STALLS_L2_PENDING", 0);
@@ -71,16 +74,16 @@ DECLARE_READ_PMC(ivybridge, ldm_stall_cycles)
    DBG_LOG(DEBUG, "read stall L2 cycles diff %lu; llc_hit %lu; cycles diff remote_dram %lu; local_dram %lu\n",
 		   l2_pending_diff, llc_hit_diff, remote_dram_diff, local_dram_diff);
 
+   // lines read from NVM, used to estimate the NVM bandwidth
+   tls_nvm_line_reads = remote_dram_diff + local_dram_diff;
+
    if ((remote_dram_diff == 0) && (local_dram_diff == 0)) return 0;
 #ifdef MEMLAT_SUPPORT
    tls_global_local_dram += local_dram_diff;
 #endif
 
    // calculate stalls based on L2 stalls and LLC miss/hit
-   double num = L3_FACTOR * (remote_dram_diff + local_dram_diff);
-   double den = num + llc_hit_diff;
-   if (den == 0) return 0;
-   return (uint64_t) ((double)l2_pending_diff * (num / den));
+   return llc_stall_cycles(l2_pending_diff, remote_dram_diff + local_dram_diff, llc_hit_diff, L3_FACTOR);
 }
 
 
@@ -108,22 +111,65 @@ DECLARE_READ_PMC(ivybridge, remote_dram)
    DBG_LOG(DEBUG, "read stall L2 cycles diff %lu; llc_hit %lu; cycles diff remote_dram %lu; local_dram %lu\n",
 		   l2_pending_diff, llc_hit_diff, remote_dram_diff, local_dram_diff);
 
+   // only the remote node emulates NVM
+   tls_nvm_line_reads = remote_dram_diff;
+
    if ((remote_dram_diff == 0) && (local_dram_diff == 0)) return 0;
 #ifdef MEMLAT_SUPPORT
    tls_global_remote_dram += remote_dram_diff;
 #endif
 
    // calculate stalls based on L2 stalls and LLC miss/hit
-   double num = L3_FACTOR * (remote_dram_diff + local_dram_diff);
-   double den = num + llc_hit_diff;
-   if (den == 0) return 0;
-   double stalls = (double)l2_pending_diff * (num / den);
+   uint64_t stalls = llc_stall_cycles(l2_pending_diff, remote_dram_diff + local_dram_diff, llc_hit_diff, L3_FACTOR);
 
    // calculate remote dram stalls based on total stalls and local/remote dram accesses
    // also consider the weight of remote memory access against local memory access
-   den = (remote_dram_diff * tls_hw_remote_latency) + (local_dram_diff * tls_hw_local_latency);
-   if (den == 0) return 0;
-   return (uint64_t) (stalls * ((double)(remote_dram_diff * tls_hw_remote_latency) / den));
+   return remote_stall_cycles(stalls, remote_dram_diff, local_dram_diff, tls_hw_remote_latency, tls_hw_local_latency);
+}
+
+
+DECLARE_ENABLE_PMC(ivybridge, dram_writebacks)
+{
+    ASSIGN_PMC_HW_EVENT_TO_ME("L2_LINES_OUT:DIRTY_ALL", 0);
+    // shared with the stall events, they take no counter of their own
+    ASSIGN_PMC_HW_EVENT_TO_ME("MEM_LOAD_UOPS_LLC_HIT_RETIRED:XSNP_NONE", 1);
+    ASSIGN_PMC_HW_EVENT_TO_ME("MEM_LOAD_UOPS_LLC_MISS_RETIRED:REMOTE_DRAM", 2);
+    ASSIGN_PMC_HW_EVENT_TO_ME("MEM_LOAD_UOPS_LLC_MISS_RETIRED:LOCAL_DRAM", 3);
+
+    return E_SUCCESS;
+}
+
+DECLARE_CLEAR_PMC(ivybridge, dram_writebacks)
+{
+}
+
+DECLARE_READ_PMC(ivybridge, dram_writebacks)
+{
+   return read_llc_writebacks(event, 0, 1, 2, 2);
+}
+
+
+DECLARE_ENABLE_PMC(ivybridge, memory_parallelism)
+{
+    ASSIGN_PMC_HW_EVENT_TO_ME("OFFCORE_REQUESTS_OUTSTANDING:DEMAND_DATA_RD", 0);
+    ASSIGN_PMC_HW_EVENT_TO_ME("OFFCORE_REQUESTS_OUTSTANDING:CYCLES_WITH_DEMAND_DATA_RD", 1);
+
+    return E_SUCCESS;
+}
+
+DECLARE_CLEAR_PMC(ivybridge, memory_parallelism)
+{
+}
+
+DECLARE_READ_PMC(ivybridge, memory_parallelism)
+{
+   uint64_t occupancy_diff = READ_MY_HW_EVENT_DIFF(0);
+   uint64_t busy_cycles_diff = READ_MY_HW_EVENT_DIFF(1);
+
+   DBG_LOG(DEBUG, "read outstanding demand reads diff %lu; cycles with demand reads diff %lu\n",
+		   occupancy_diff, busy_cycles_diff);
+
+   return memory_parallelism(occupancy_diff, busy_cycles_diff);
 }
 
 
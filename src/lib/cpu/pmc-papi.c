@@ -13,135 +13,131 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 ***************************************************************************/
 #include <papi.h>
 #include <pthread.h>
-#include <sys/syscall.h>
-#include "cpu/pmc-papi.h"
+#include <stdlib.h>
+#include <string.h>
+#include "cpu/pmc.h"
 #include "debug.h"
+#include "error.h"
 
-__thread int tls_event_set = PAPI_NULL;
-
-#define STR_MAX_SIZE 256
+// PAPI counts per thread like the perf backend, through the library. The
+// events are added to the event set of each thread in counter order, and
+// PAPI_read() returns them in that order.
 
 static void log_papi_critical(int ret_val, const char *msg) {
-	//char papi_str[STR_MAX_SIZE];
-	//PAPI_perror(ret_val, (char *)papi_str, sizeof(papi_str));
     DBG_LOG(CRITICAL, "%s (%s)\n", msg, PAPI_strerror(ret_val));
 }
 
-int pmc_init() {
+static int papi_init(pmc_events_t* events)
+{
 	int ret_val;
 
     if ((ret_val = PAPI_library_init(PAPI_VER_CURRENT)) != PAPI_VER_CURRENT) {
         log_papi_critical(ret_val, "PMC library init error");
-        return -1;
+        return E_ERROR;
     }
 
     if ((ret_val = PAPI_thread_init(pthread_self)) != PAPI_OK) {
         log_papi_critical(ret_val, "PMC thread support init error");
-        return -1;
+        return E_ERROR;
     }
 
-//    if ((ret_val = PAPI_set_domain(PAPI_DOM_ALL)) != PAPI_OK) {
-//        log_papi_critical(ret_val, "PMC set domain error");
-//        return -1;
-//    }
-
-    return 0;
+    return E_SUCCESS;
 }
 
-void pmc_shutdown() {
+static void papi_shutdown()
+{
     PAPI_shutdown();
 }
 
-int pmc_create_event_set_local_thread() {
-	int ret_val;
+// the hardware events are named as in perfmon2, which PAPI understands
+static int papi_enable_hw_event(pmc_events_t* events, pmc_hw_event_t* event)
+{
+    int ret_val, code;
 
-    if ((ret_val = PAPI_create_eventset(&tls_event_set)) != PAPI_OK) {
-        log_papi_critical(ret_val, "PMC event set init error");
-        return -1;
+    if ((ret_val = PAPI_event_name_to_code(event->name, &code)) != PAPI_OK) {
+        log_papi_critical(ret_val, event->name);
+        return E_ERROR;
     }
-
-//    if ((ret_val = PAPI_set_granularity(PAPI_GRN_SYS)) != PAPI_OK) {
-//        log_papi_critical(ret_val, "PMC set granularity error");
-//        return -1;
-//    }
-
-    return 0;
+    return E_SUCCESS;
 }
 
-void pmc_destroy_event_set_local_thread() {
-    PAPI_cleanup_eventset(tls_event_set);
-    PAPI_destroy_eventset(&tls_event_set);
-}
+static void papi_close_thread(pmc_events_t* events, pmc_thread_t* thread)
+{
+    int* event_set = thread->counters;
+    long long values[PMC_MAX_HW_CNTRS];
 
-int pmc_register_thread() {
-	return PAPI_register_thread();
+    PAPI_stop(*event_set, values);
+    PAPI_cleanup_eventset(*event_set);
+    PAPI_destroy_eventset(event_set);
+    PAPI_unregister_thread();
+    free(event_set);
 }
 
-int pmc_unregister_thread() {
-	return PAPI_unregister_thread();
-}
+static int papi_open_thread(pmc_events_t* events, pmc_thread_t* thread, pid_t tid)
+{
+    int* event_set;
+    pmc_hw_event_t* event;
+    int i, ret_val;
 
-int pmc_register_event_local_thread(const char *event_name) {
-    int ret_val;
-    char msg[STR_MAX_SIZE];
-
-    // The pthread scope for each thread should be set to PTHREAD_SCOPE_SYSTEM.
-    // On linux, pthread supports only PTHREAD_SCOPE_SYSTEM.
-
-    assert(tls_event_set != PAPI_NULL);
-    assert(event_name);
-
-    if ((ret_val = PAPI_add_named_event(tls_event_set, (char *)event_name)) != PAPI_OK) {
-    	snprintf(msg, sizeof(msg), "PMC event (%s) register error", event_name);
-    	log_papi_critical(ret_val, msg);
-        return -1;
+    if (!(event_set = malloc(sizeof(int)))) {
+        return E_NOMEM;
     }
+    *event_set = PAPI_NULL;
+    PAPI_register_thread();
+    thread->counters = event_set;
 
-    return 0;
-}
-
-int pmc_events_start_local_thread() {
-    int ret_val;
-
-    assert(tls_event_set != PAPI_NULL);
-
-    if ((ret_val = PAPI_start(tls_event_set)) != PAPI_OK) {
+    if ((ret_val = PAPI_create_eventset(event_set)) != PAPI_OK) {
+        log_papi_critical(ret_val, "PMC event set init error");
+        goto error;
+    }
+    for (i = 0; i < events->num_avail_hw_cntrs; i++) {
+        if ((event = events->hw_cntrs[i]) && event->active) {
+            DBG_LOG(INFO, "registering event %s, thread id [%d]\n", event->name, tid);
+            if ((ret_val = PAPI_add_named_event(*event_set, event->name)) != PAPI_OK) {
+                log_papi_critical(ret_val, event->name);
+                goto error;
+            }
+        }
+    }
+    if ((ret_val = PAPI_start(*event_set)) != PAPI_OK) {
     	log_papi_critical(ret_val, "PMC events start error");
-        return -1;
+        goto error;
     }
+    return E_SUCCESS;
 
-    return 0;
-}
-
-void pmc_events_stop_local_thread() {
-	long long values[MAX_NUM_EVENTS];
-
-	assert(tls_event_set != PAPI_NULL);
-
-    PAPI_stop(tls_event_set, values);
+error:
+    papi_close_thread(events, thread);
+    thread->counters = NULL;
+    return E_ERROR;
 }
 
-int pmc_events_read_local_thread(long long *values) {
+static void papi_read(pmc_events_t* events, pmc_thread_t* thread, uint64_t* vals)
+{
+    long long values[PMC_MAX_HW_CNTRS];
+    pmc_hw_event_t* event;
+    int i, n = 0;
     int ret_val;
-//    int status = 0;
-
-    assert(values);
-
-//    PAPI_state(event_set, &status);
-//    if (status != PAPI_RUNNING) {
-//        DBG_LOG(CRITICAL, "PMC event set not in running state");
-//        return -1;
-//    }
 
-    if ((ret_val = PAPI_read(tls_event_set, values)) != PAPI_OK) {
+    if ((ret_val = PAPI_read(*(int*) thread->counters, values)) != PAPI_OK) {
     	log_papi_critical(ret_val, "PMC events read error");
-        return -1;
+        // empty counts for this epoch
+        memcpy(vals, thread->last_val, sizeof(thread->last_val));
+        return;
     }
-
-    if ((ret_val = PAPI_reset(tls_event_set)) != PAPI_OK) {
-        log_papi_critical(ret_val, "PMC events reset error");
-        return -1;
+    for (i = 0; i < events->num_avail_hw_cntrs; i++) {
+        if ((event = events->hw_cntrs[i]) && event->active) {
+            vals[i] = (uint64_t) values[n++];
+        }
     }
-
-    return 0;
 }
+
+pmc_backend_t pmc_papi_backend = {
+    .name = "papi",
+    .per_thread = 1,
+    .init = papi_init,
+    .shutdown = papi_shutdown,
+    .enable_hw_event = papi_enable_hw_event,
+    .open_thread = papi_open_thread,
+    .close_thread = papi_close_thread,
+    .read = papi_read
+};
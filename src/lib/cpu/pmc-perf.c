@@ -0,0 +1,222 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.  
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "cpu/pmc.h"
+#include "debug.h"
+#include "error.h"
+#include "thread.h"
+
+// PERFEVTSEL bits the kernel sets itself, the rest of the encoding is the raw event
+#define EVTSEL_USR (1ULL << 16)
+#define EVTSEL_OS (1ULL << 17)
+#define EVTSEL_PC (1ULL << 19)
+#define EVTSEL_INT (1ULL << 20)
+#define EVTSEL_EN (1ULL << 22)
+#define EVTSEL_CONTROL_BITS (EVTSEL_USR | EVTSEL_OS | EVTSEL_PC | EVTSEL_INT | EVTSEL_EN)
+
+typedef struct {
+    int fd[PMC_MAX_HW_CNTRS]; // -1 when the counter is not active
+    struct perf_event_mmap_page* page[PMC_MAX_HW_CNTRS];
+    int set_leader[PMC_MAX_HW_CNTRS]; // fd leading the group of each set of multiplexed counters
+    uint64_t enabled[PMC_MAX_HW_CNTRS]; // nanoseconds, as of the last read
+    uint64_t running[PMC_MAX_HW_CNTRS];
+} perf_counters_t;
+
+// what read() returns with the read_format of the counters
+typedef struct {
+    uint64_t value;
+    uint64_t enabled;
+    uint64_t running;
+} perf_read_format_t;
+
+static long page_size;
+
+static int perf_init(pmc_events_t* events)
+{
+    page_size = sysconf(_SC_PAGESIZE);
+    return E_SUCCESS;
+}
+
+static void perf_close_thread(pmc_events_t* events, pmc_thread_t* thread)
+{
+    perf_counters_t* counters = thread->counters;
+    int i;
+
+    for (i = PMC_MAX_HW_CNTRS - 1; i >= 0; i--) {
+        if (counters->page[i]) {
+            munmap(counters->page[i], page_size);
+        }
+        if (counters->fd[i] >= 0) {
+            close(counters->fd[i]);
+        }
+    }
+    free(counters);
+}
+
+// Opens the active counters as one group, so that the kernel schedules them
+// together and the counts of a snapshot cover the same interval, and maps
+// their user pages to read them with rdpmc. Multiplexed counters get a group
+// for the pinned ones and one per set, only the first set enabled.
+static int perf_open_thread(pmc_events_t* events, pmc_thread_t* thread, pid_t tid)
+{
+    struct perf_event_attr attr;
+    perf_counters_t* counters;
+    pmc_hw_event_t* event;
+    void* page;
+    int i, set, leader, pinned_leader = -1;
+
+    if (!(counters = malloc(sizeof(perf_counters_t)))) {
+        return E_NOMEM;
+    }
+    for (i = 0; i < PMC_MAX_HW_CNTRS; i++) {
+        counters->fd[i] = -1;
+        counters->page[i] = NULL;
+        counters->set_leader[i] = -1;
+        counters->enabled[i] = counters->running[i] = 0;
+    }
+    thread->counters = counters;
+
+    for (i = 0; i < pmc_num_hw_cntrs(events); i++) {
+        if (!(event = events->hw_cntrs[i]) || !event->active) {
+            continue;
+        }
+        set = pmc_hw_cntr_set(events, i);
+        leader = set < 0 ? pinned_leader : counters->set_leader[set];
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_RAW;
+        attr.config = event->encoding & ~EVTSEL_CONTROL_BITS;
+        attr.exclude_kernel = !(event->encoding & EVTSEL_OS);
+        attr.exclude_user = !(event->encoding & EVTSEL_USR);
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        // sets but the first start disabled, group members follow their leader
+        attr.disabled = set > 0 && leader < 0;
+
+        if ((counters->fd[i] = (int) syscall(__NR_perf_event_open, &attr, tid, -1, leader, 0)) < 0) {
+            DBG_LOG(ERROR, "thread id [%d] cannot open a counter for %s\n", tid, event->name);
+            perf_close_thread(events, thread);
+            thread->counters = NULL;
+            return E_ERROR;
+        }
+        if (leader < 0 && set < 0) {
+            pinned_leader = counters->fd[i];
+        } else if (leader < 0) {
+            counters->set_leader[set] = counters->fd[i];
+        }
+        // without the page the counter is read through the kernel
+        if ((page = mmap(NULL, page_size, PROT_READ, MAP_SHARED, counters->fd[i], 0)) != MAP_FAILED) {
+            counters->page[i] = page;
+        }
+    }
+    return E_SUCCESS;
+}
+
+// The self-monitoring protocol of the perf mmap page: the count is the offset
+// the kernel keeps plus the hardware counter the event is scheduled on, both
+// read under the page's sequence lock. The enabled and running times the
+// kernel saved when it last scheduled the event grow by the TSC cycles since
+// then while it is on the counter, and are left as saved otherwise: an event
+// of a set switched off is not enabled any more.
+static uint64_t perf_read_counter(int fd, struct perf_event_mmap_page* page, uint64_t* enabled, uint64_t* running)
+{
+    perf_read_format_t format;
+    uint32_t seq, index;
+    uint64_t count, cycles, delta;
+    int64_t pmc;
+    int shift;
+
+    if (page && page->cap_user_rdpmc && page->cap_user_time) {
+        do {
+            seq = page->lock;
+            __asm__ __volatile__ ("" ::: "memory");
+            *enabled = page->time_enabled;
+            *running = page->time_running;
+            index = page->index;
+            count = page->offset;
+            if (index) {
+                shift = 64 - page->pmc_width;
+                pmc = rdpmc(index - 1);
+                count += (pmc << shift) >> shift;
+                cycles = hrtime_now();
+                delta = page->time_offset + (cycles >> page->time_shift) * page->time_mult +
+                        (((cycles & ((1ULL << page->time_shift) - 1)) * page->time_mult) >> page->time_shift);
+                *enabled += delta;
+                *running += delta;
+            }
+            __asm__ __volatile__ ("" ::: "memory");
+        } while (page->lock != seq);
+        return count;
+    }
+
+    if (read(fd, &format, sizeof(format)) != sizeof(format)) {
+        *enabled = *running = 0;
+        return 0;
+    }
+    *enabled = format.enabled;
+    *running = format.running;
+    return format.value;
+}
+
+static void perf_read(pmc_events_t* events, pmc_thread_t* thread, uint64_t* vals)
+{
+    perf_counters_t* counters = thread->counters;
+    int i;
+
+    for (i = 0; i < pmc_num_hw_cntrs(events); i++) {
+        if (counters->fd[i] >= 0) {
+            vals[i] = perf_read_counter(counters->fd[i], counters->page[i],
+                                        &counters->enabled[i], &counters->running[i]);
+        }
+    }
+}
+
+static void perf_read_times(pmc_events_t* events, pmc_thread_t* thread, uint64_t* enabled, uint64_t* running)
+{
+    perf_counters_t* counters = thread->counters;
+
+    memcpy(enabled, counters->enabled, sizeof(counters->enabled));
+    memcpy(running, counters->running, sizeof(counters->running));
+}
+
+static int perf_switch_set(pmc_events_t* events, pmc_thread_t* thread, int set)
+{
+    perf_counters_t* counters = thread->counters;
+    int from = counters->set_leader[thread->hw_cntr_set];
+    int to = counters->set_leader[set];
+
+    if ((from >= 0 && ioctl(from, PERF_EVENT_IOC_DISABLE, 0) < 0) ||
+            (to >= 0 && ioctl(to, PERF_EVENT_IOC_ENABLE, 0) < 0)) {
+        return E_ERROR;
+    }
+    return E_SUCCESS;
+}
+
+pmc_backend_t pmc_perf_backend = {
+    .name = "perf",
+    .per_thread = 1,
+    .init = perf_init,
+    .open_thread = perf_open_thread,
+    .close_thread = perf_close_thread,
+    .read = perf_read,
+    .read_times = perf_read_times,
+    .switch_set = perf_switch_set
+};
@@ -0,0 +1,255 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.  
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu/pmc.h"
+#include "debug.h"
+#include "error.h"
+#include "sim.h"
+#include "thread.h"
+
+// Simulated counters, see sim.h. With simulation.pmc_script every read of
+// the counters of a thread adds the next line of the script to them, so that
+// epoch after epoch sees the counts of the script in order, starting over at
+// its end. Without a script the counters grow at the rates of
+// simulation.pmc_rates with the TSC. Hardware events that are not named
+// count nothing, and multiplexed counters only count while their set does.
+// Counters are enabled and running for the TSC cycles their set counted.
+
+typedef struct {
+    uint64_t count[PMC_MAX_HW_CNTRS];
+    int step; // next line of the script, -1 before the baseline read
+    hrtime_t last_read;
+    hrtime_t running_cycles[PMC_MAX_HW_CNTRS]; // since the thread opened its counters
+} sim_counters_t;
+
+static int num_known_hw_events;
+static uint64_t* sim_script = NULL; // counts of each line, by known hardware event
+static int sim_script_steps = 0;
+static double* sim_rates = NULL; // counts per 1000 TSC cycles, by known hardware event
+
+static int known_hw_event_index(pmc_events_t* events, const char* name)
+{
+    int i;
+
+    for (i = 0; events->known_hw_events[i].name; i++) {
+        if (strcasecmp(events->known_hw_events[i].name, name) == 0) {
+            return i;
+        }
+    }
+    DBG_LOG(ERROR, "Unknown hardware performance monitoring event %s\n", name);
+    return -1;
+}
+
+// Parses "NAME=value" into the slot of the named hardware event
+static int parse_event_value(pmc_events_t* events, char* token, double* values)
+{
+    char* sep;
+    int i;
+
+    if (!(sep = strchr(token, '='))) {
+        DBG_LOG(ERROR, "Expected NAME=value, found %s\n", token);
+        return E_INVAL;
+    }
+    *sep = '\0';
+    if ((i = known_hw_event_index(events, token)) < 0) {
+        return E_INVAL;
+    }
+    values[i] = atof(sep + 1);
+    return E_SUCCESS;
+}
+
+// One line per read of the counters, with the "NAME=count" of the hardware
+// events separated by blanks; '#' starts a comment and empty lines are skipped
+static int load_script(pmc_events_t* events, const char* path)
+{
+    FILE* fp;
+    char* line = NULL;
+    char* token;
+    char* saveptr;
+    char* str;
+    size_t len = 0;
+    double* counts;
+    int i, empty;
+    int ret = E_SUCCESS;
+
+    if (!(fp = fopen(path, "r"))) {
+        DBG_LOG(ERROR, "Can't open the counter script %s\n", path);
+        return E_ERROR;
+    }
+    if (!(counts = malloc(num_known_hw_events * sizeof(double)))) {
+        fclose(fp);
+        return E_NOMEM;
+    }
+
+    while (ret == E_SUCCESS && getline(&line, &len, fp) != -1) {
+        if ((str = strchr(line, '#'))) {
+            *str = '\0';
+        }
+        memset(counts, 0, num_known_hw_events * sizeof(double));
+        for (str = line, empty = 1; (token = strtok_r(str, " \t\r\n", &saveptr)); str = NULL, empty = 0) {
+            if ((ret = parse_event_value(events, token, counts)) != E_SUCCESS) {
+                break;
+            }
+        }
+        if (ret != E_SUCCESS || empty) {
+            continue;
+        }
+        if (!(sim_script = realloc(sim_script, (sim_script_steps + 1) * num_known_hw_events * sizeof(uint64_t)))) {
+            ret = E_NOMEM;
+            break;
+        }
+        for (i = 0; i < num_known_hw_events; i++) {
+            sim_script[sim_script_steps * num_known_hw_events + i] = (uint64_t) counts[i];
+        }
+        sim_script_steps++;
+    }
+
+    free(counts);
+    free(line);
+    fclose(fp);
+    if (ret == E_SUCCESS && !sim_script_steps) {
+        DBG_LOG(ERROR, "The counter script %s is empty\n", path);
+        ret = E_INVAL;
+    }
+    return ret;
+}
+
+// "NAME=rate;..." in counts per 1000 TSC cycles
+static int parse_rates(pmc_events_t* events, const char* rates)
+{
+    char* str;
+    char* token;
+    char* saveptr;
+    char* copy;
+    int ret = E_SUCCESS;
+
+    if (!(copy = strdup(rates))) {
+        return E_NOMEM;
+    }
+    for (str = copy; (token = strtok_r(str, ";", &saveptr)); str = NULL) {
+        if ((ret = parse_event_value(events, token, sim_rates)) != E_SUCCESS) {
+            break;
+        }
+    }
+    free(copy);
+    return ret;
+}
+
+static int sim_init(pmc_events_t* events)
+{
+    for (num_known_hw_events = 0; events->known_hw_events[num_known_hw_events].name; num_known_hw_events++);
+
+    if (simulation.pmc_script) {
+        DBG_LOG(INFO, "Replaying the performance counters from %s\n", simulation.pmc_script);
+        return load_script(events, simulation.pmc_script);
+    }
+
+    if (!(sim_rates = calloc(num_known_hw_events, sizeof(double)))) {
+        return E_NOMEM;
+    }
+    if (simulation.pmc_rates) {
+        return parse_rates(events, simulation.pmc_rates);
+    }
+    DBG_LOG(WARNING, "Neither simulation.pmc_script nor simulation.pmc_rates are set, no event is counted\n");
+    return E_SUCCESS;
+}
+
+static void sim_shutdown()
+{
+    free(sim_script);
+    free(sim_rates);
+    sim_script = NULL;
+    sim_rates = NULL;
+    sim_script_steps = 0;
+}
+
+static int sim_open_thread(pmc_events_t* events, pmc_thread_t* thread, pid_t tid)
+{
+    sim_counters_t* counters;
+
+    if (!(counters = calloc(1, sizeof(sim_counters_t)))) {
+        return E_NOMEM;
+    }
+    counters->step = -1;
+    counters->last_read = hrtime_now();
+    thread->counters = counters;
+    return E_SUCCESS;
+}
+
+static void sim_close_thread(pmc_events_t* events, pmc_thread_t* thread)
+{
+    free(thread->counters);
+}
+
+static void sim_read(pmc_events_t* events, pmc_thread_t* thread, uint64_t* vals)
+{
+    sim_counters_t* counters = thread->counters;
+    hrtime_t now = hrtime_now();
+    pmc_hw_event_t* event;
+    int i, id, set;
+
+    for (i = 0; i < pmc_num_hw_cntrs(events); i++) {
+        if (!(event = events->hw_cntrs[i]) || !event->active) {
+            continue;
+        }
+        id = event - events->known_hw_events;
+        set = pmc_hw_cntr_set(events, i);
+        // multiplexed counters of the other sets are stopped
+        if (set < 0 || set == thread->hw_cntr_set) {
+            counters->running_cycles[i] += now - counters->last_read;
+            if (sim_script && counters->step >= 0) {
+                counters->count[i] += sim_script[counters->step * num_known_hw_events + id];
+            } else if (!sim_script) {
+                counters->count[i] = (uint64_t) (sim_rates[id] * counters->running_cycles[i] / 1000);
+            }
+        }
+        vals[i] = counters->count[i];
+    }
+    counters->last_read = now;
+    // the first read is the baseline of the thread's snapshots
+    if (sim_script) {
+        counters->step = (counters->step + 1) % sim_script_steps;
+    }
+}
+
+// never shared with other users, running as long as enabled
+static void sim_read_times(pmc_events_t* events, pmc_thread_t* thread, uint64_t* enabled, uint64_t* running)
+{
+    sim_counters_t* counters = thread->counters;
+    int i;
+
+    for (i = 0; i < pmc_num_hw_cntrs(events); i++) {
+        enabled[i] = running[i] = counters->running_cycles[i];
+    }
+}
+
+// the read above follows the thread's current set
+static int sim_switch_set(pmc_events_t* events, pmc_thread_t* thread, int set)
+{
+    return E_SUCCESS;
+}
+
+pmc_backend_t pmc_sim_backend = {
+    .name = SIM_PMC_BACKEND,
+    .per_thread = 1,
+    .init = sim_init,
+    .shutdown = sim_shutdown,
+    .open_thread = sim_open_thread,
+    .close_thread = sim_close_thread,
+    .read = sim_read,
+    .read_times = sim_read_times,
+    .switch_set = sim_switch_set
+};
@@ -11,19 +11,20 @@ should have received a copy of the GNU General Public License along
 with this program; if not, write to the Free Software Foundation,
 Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 ***************************************************************************/
+#define _GNU_SOURCE
+#include <sched.h>
 #include <stdlib.h>
+#include <string.h>
 #include "cpu/pmc.h"
 #include "dev.h"
 #include "error.h"
 #include "thread.h"
-#include "topology.h"
+#include "epoch_log.h"
 
 #pragma GCC push_options
 #pragma GCC optimize ("O0")
 
-// The width of general purpose counters are 40bits.
-// https://www.felixcloutier.com/x86/RDPMC.html
-#define RDPMC_MAX_VALUE 0xFFFFFFFFFF  
+__thread pmc_snapshot_t tls_pmc_snapshot;
 
 long long rdpmc(int counter) 
 {
@@ -35,7 +36,6 @@ long long rdpmc(int counter)
 	__asm__ __volatile__ ("mov %2, %%ecx\n\t"
 	                      "rdpmc\n\t"
 	                      "mov %%eax, %0\n\t"
-	                      "and $255, %%edx\n\t"
 	                      "mov %%edx, %1\n\t"
 	                      : "=m" (eax), "=m" (edx), "=m" (counter)
 	                      : /* no inputs */
@@ -81,8 +81,9 @@ int get_avail_hw_cntr_id(pmc_events_t* events)
     int used;
     pmc_hw_event_t* event = 0;
     int status = -1;
+    int num_hw_cntrs = pmc_num_hw_cntrs(events);
 
-    int* hw_cntr_id_status = calloc(events->num_avail_hw_cntrs, sizeof(int));
+    int* hw_cntr_id_status = calloc(num_hw_cntrs, sizeof(int));
     
     for (i=0, used=0; events->known_hw_events[i].name; i++) {
         event = &events->known_hw_events[i];
@@ -92,11 +93,11 @@ int get_avail_hw_cntr_id(pmc_events_t* events)
         }
     }
     
-    if (used == events->num_avail_hw_cntrs) {
+    if (used == num_hw_cntrs) {
         goto done;
     }
 
-    for (i=0; events->num_avail_hw_cntrs; i++) {
+    for (i=0; i < num_hw_cntrs; i++) {
         if (hw_cntr_id_status[i] == 0) {
             status = i;
             goto done;
@@ -120,6 +121,8 @@ pmc_hw_event_t* enable_pmc_hw_event(pmc_events_t* events, const char* name)
         if (strcasecmp(event->name, name) == 0) {
         	found = 1;
             if (event->active) {
+                // already counting, the derived events share the counter
+                event->active++;
                 return event;
             }
             break;
@@ -134,25 +137,20 @@ pmc_hw_event_t* enable_pmc_hw_event(pmc_events_t* events, const char* name)
     // enable it 
     // need to find an available performance counter to monitor this event
     if ((event->hw_cntr_id = get_avail_hw_cntr_id(events)) < 0) {
-        DBG_LOG(ERROR, "No available hardware performance counters\n");
+        DBG_LOG(WARNING, "No available hardware performance counters for %s\n", name);
         return NULL;
     }
 
-    // assign an array to keep per processor last read values (useful to calculate the diff since the last read)
-    int num_cpus = system_num_cpus();
-    if (!event->last_val) {
-        event->last_val = calloc(num_cpus, sizeof(*event->last_val));
-    }
-    for (i=0; i<num_cpus; i++) {
-        event->last_val[i] = 0;
-    }
-    // call into the kernel driver to enable the counter on all processors
-    if (set_counter(event->hw_cntr_id, event->encoding) != E_SUCCESS) {
-    	DBG_LOG(ERROR, "Can't enable counter on all processors\n");
-    	return NULL;
+    if (events->backend->enable_hw_event && events->backend->enable_hw_event(events, event) != E_SUCCESS) {
+        return NULL;
     }
 
     event->active = 1;
+    events->hw_cntrs[event->hw_cntr_id] = event;
+    if (pmc_hw_cntr_set(events, event->hw_cntr_id) >= events->num_hw_cntr_sets) {
+        events->num_hw_cntr_sets = pmc_hw_cntr_set(events, event->hw_cntr_id) + 1;
+        DBG_LOG(INFO, "%s is counted in set %d of the multiplexed counters\n", name, events->num_hw_cntr_sets - 1);
+    }
     return event;
 }
 
@@ -180,6 +178,7 @@ void disable_pmc_hw_event(pmc_events_t* events, const char* name)
     }
 
     event->active = 0;
+    events->hw_cntrs[event->hw_cntr_id] = NULL;
 }
 
 void clear_pmc_hw_event(pmc_hw_event_t* event)
@@ -187,25 +186,213 @@ void clear_pmc_hw_event(pmc_hw_event_t* event)
     DBG_LOG(CRITICAL, "Unimplemented functionality\n");
 }
 
-uint64_t read_pmc_hw_event_cur(pmc_hw_event_t* event)
+// Counts of a multiplexed counter that did not count during an epoch the
+// counting ones were enabled for epoch_time, at the rate of the last epoch
+// it counted
+static uint64_t estimate_hw_cntr_diff(pmc_thread_t* thread, int i, uint64_t epoch_time)
+{
+    return pmc_extrapolate(thread->running_diffs[i], epoch_time, thread->running_time[i]);
+}
+
+// Reads all the active counters back to back, so that the counts of the
+// snapshot cover the same interval, then computes their diffs since the
+// previous snapshot of the calling thread. With counters programmed on the
+// processor, a thread seen on another one than at its previous snapshot
+// starts over with empty counts, and so does a thread that keeps migrating
+// while it reads them: its values mix the counters of two processors.
+// Multiplexed counters move on to their next set once read.
+void read_pmc_snapshot(pmc_events_t* events, pmc_thread_t* thread)
+{
+    int per_thread = events->backend->per_thread;
+    int multiplexed = events->num_hw_cntr_sets > 1;
+    int timed = events->backend->read_times != NULL;
+    int logged = epoch_log_enabled();
+    uint64_t cur_val[PMC_MAX_HW_CNTRS];
+    uint64_t enabled[PMC_MAX_HW_CNTRS];
+    uint64_t running[PMC_MAX_HW_CNTRS];
+    uint64_t enabled_time, running_time, epoch_time = 0;
+    pmc_hw_event_t* event;
+    int cpu_id, migrated, attempts = 0;
+    int i, set;
+
+    do {
+        cpu_id = per_thread ? 0 : sched_getcpu();
+        events->backend->read(events, thread, cur_val);
+        migrated = !per_thread && sched_getcpu() != cpu_id;
+    } while (migrated && ++attempts < PMC_SNAPSHOT_READ_ATTEMPTS);
+    if (timed) {
+        events->backend->read_times(events, thread, enabled, running);
+    }
+
+    // the sets that did not count are estimated over the time the others did
+    for (i = 0; multiplexed && i < pmc_num_hw_cntrs(events); i++) {
+        if ((event = events->hw_cntrs[i]) && event->active &&
+                ((set = pmc_hw_cntr_set(events, i)) < 0 || set == thread->hw_cntr_set) &&
+                enabled[i] - thread->last_enabled[i] > epoch_time) {
+            epoch_time = enabled[i] - thread->last_enabled[i];
+        }
+    }
+
+    for (i = 0; i < pmc_num_hw_cntrs(events); i++) {
+        if (!(event = events->hw_cntrs[i]) || !event->active) {
+            tls_pmc_snapshot.diffs[i] = 0;
+            continue;
+        }
+        if (migrated || cpu_id != thread->cpu_id) {
+            tls_pmc_snapshot.diffs[i] = 0;
+        } else if (multiplexed && (set = pmc_hw_cntr_set(events, i)) >= 0 && set != thread->hw_cntr_set) {
+            tls_pmc_snapshot.diffs[i] = estimate_hw_cntr_diff(thread, i, epoch_time);
+        } else {
+            // modular arithmetic handles a counter that wrapped around since
+            tls_pmc_snapshot.diffs[i] = (cur_val[i] - thread->last_val[i]) & events->hw_cntr_mask;
+            if (timed) {
+                enabled_time = enabled[i] - thread->last_enabled[i];
+                running_time = running[i] - thread->last_running[i];
+                // the kernel gave the counter to others part of the epoch
+                if (running_time < enabled_time) {
+                    tls_pmc_snapshot.diffs[i] = pmc_extrapolate(tls_pmc_snapshot.diffs[i], enabled_time, running_time);
+                }
+                thread->running_diffs[i] = tls_pmc_snapshot.diffs[i];
+                thread->running_time[i] = enabled_time;
+            }
+        }
+        thread->last_val[i] = cur_val[i];
+        if (timed) {
+            thread->last_enabled[i] = enabled[i];
+            thread->last_running[i] = running[i];
+        }
+        if (logged) {
+            tls_counter_diffs[i] += tls_pmc_snapshot.diffs[i];
+        }
+    }
+    // values of no single processor, the next snapshot starts over too
+    thread->cpu_id = migrated ? -1 : cpu_id;
+
+    if (multiplexed) {
+        set = (thread->hw_cntr_set + 1) % events->num_hw_cntr_sets;
+        if (events->backend->switch_set(events, thread, set) == E_SUCCESS) {
+            thread->hw_cntr_set = set;
+        }
+    }
+}
+
+static pmc_backend_t* pmc_backends[] = {
+    &pmc_nvmemul_backend,
+    &pmc_perf_backend,
+    &pmc_sim_backend,
+#ifdef PAPI_SUPPORT
+    &pmc_papi_backend,
+#endif
+    NULL
+};
+
+// Must be called before any event is enabled
+int pmc_set_backend(pmc_events_t* events, const char* name)
+{
+    int i;
+
+    for (i = 0; pmc_backends[i]; i++) {
+        if (strcasecmp(pmc_backends[i]->name, name) == 0) {
+            break;
+        }
+    }
+    if (!pmc_backends[i]) {
+        DBG_LOG(ERROR, "Unknown performance counter backend %s\n", name);
+        return E_INVAL;
+    }
+
+    events->backend = pmc_backends[i];
+    // virtual counts are kept by the kernel or the library on 64 bits
+    if (events->backend->per_thread) {
+        events->hw_cntr_mask = ~0ULL;
+    }
+    if (events->backend->init && events->backend->init(events) != E_SUCCESS) {
+        return E_ERROR;
+    }
+    DBG_LOG(INFO, "Reading the performance counters with the %s backend\n", events->backend->name);
+    return E_SUCCESS;
+}
+
+// Lets more counters than the available ones be assigned, the first
+// num_pinned_hw_cntrs counting all the time. Must be called after
+// pmc_set_backend() and before any event is enabled.
+int pmc_set_multiplex(pmc_events_t* events, int num_pinned_hw_cntrs)
+{
+    if (!events->backend->switch_set || !events->backend->read_times) {
+        DBG_LOG(WARNING, "The %s backend cannot multiplex the performance counters\n", events->backend->name);
+        return E_INVAL;
+    }
+    if (num_pinned_hw_cntrs >= events->num_avail_hw_cntrs) {
+        DBG_LOG(WARNING, "No performance counter left to multiplex\n");
+        return E_INVAL;
+    }
+
+    events->multiplex = 1;
+    events->num_pinned_hw_cntrs = num_pinned_hw_cntrs;
+    DBG_LOG(INFO, "Multiplexing %d performance counters on %d, %d of them pinned\n",
+            PMC_MAX_HW_CNTRS, events->num_avail_hw_cntrs, num_pinned_hw_cntrs);
+    return E_SUCCESS;
+}
+
+void pmc_shutdown(pmc_events_t* events)
+{
+    if (events->backend->shutdown) {
+        events->backend->shutdown();
+    }
+}
+
+int pmc_open_thread(pmc_events_t* events, pmc_thread_t* thread, pid_t tid)
+{
+    thread->cpu_id = -1;
+    // backends start counting the first set
+    thread->hw_cntr_set = 0;
+    memset(thread->last_enabled, 0, sizeof(thread->last_enabled));
+    memset(thread->last_running, 0, sizeof(thread->last_running));
+    memset(thread->running_time, 0, sizeof(thread->running_time));
+    if (!events->backend->open_thread) {
+        return E_SUCCESS;
+    }
+    return events->backend->open_thread(events, thread, tid);
+}
+
+void pmc_close_thread(pmc_events_t* events, pmc_thread_t* thread)
 {
-    return rdpmc(event->hw_cntr_id);
+    if (events->backend->close_thread && thread->counters) {
+        events->backend->close_thread(events, thread);
+    }
+    thread->counters = NULL;
+}
+
+// Counters programmed on every processor by the kernel module
+static int nvmemul_enable_hw_event(pmc_events_t* events, pmc_hw_event_t* event)
+{
+    // call into the kernel driver to enable the counter on all processors
+    if (set_counter(event->hw_cntr_id, event->encoding) != E_SUCCESS) {
+    	DBG_LOG(ERROR, "Can't enable counter on all processors\n");
+    	return E_ERROR;
+    }
+    return E_SUCCESS;
 }
 
-uint64_t read_pmc_hw_event_diff(pmc_hw_event_t* event)
+static void nvmemul_read(pmc_events_t* events, pmc_thread_t* thread, uint64_t* vals)
 {
-    int cpu_id = thread_self()->cpu_id;
-    uint64_t cur_val = read_pmc_hw_event_cur(event);
-    uint64_t last_val = event->last_val[cpu_id];
-    //if (cur_val < last_val && (event->hw_cntr_id == 0)) {
-    if (cur_val < last_val) {
-        event->last_val[cpu_id] = cur_val;
-        return (cur_val + (RDPMC_MAX_VALUE - last_val));
-    }
-    event->last_val[cpu_id] = cur_val;
-    return cur_val - last_val;
+    pmc_hw_event_t* event;
+    int i;
+
+    for (i = 0; i < events->num_avail_hw_cntrs; i++) {
+        if ((event = events->hw_cntrs[i]) && event->active) {
+            vals[i] = rdpmc(i);
+        }
+    }
 }
 
+pmc_backend_t pmc_nvmemul_backend = {
+    .name = "nvmemul",
+    .per_thread = 0,
+    .enable_hw_event = nvmemul_enable_hw_event,
+    .read = nvmemul_read
+};
+
 
 pmc_event_t* enable_pmc_event(cpu_model_t* cpu, const char* name) 
 {
@@ -233,7 +420,7 @@ pmc_event_t* enable_pmc_event(cpu_model_t* cpu, const char* name)
     event->hw_events = NULL;
     event->num_hw_events = 0;
     if (event->enable(cpu->pmc_events, event) != E_SUCCESS) {
-        assert(0 && "DIE");
+        DBG_LOG(WARNING, "Can't enable performance monitoring event %s\n", name);
         return NULL;
     }
     event->active = 1;
@@ -263,7 +450,9 @@ void release_all_pmc_hw_events_of_event(pmc_event_t* event)
     int i;
     if (event->num_hw_events > 0) {
         for (i=0; i<event->num_hw_events; i++) {
-            event->hw_events[i]->active = 0;
+            if (event->hw_events[i]->active > 0) {
+                event->hw_events[i]->active--;
+            }
         }
         free(event->hw_events);
         event->hw_events = NULL;
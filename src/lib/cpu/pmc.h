@@ -14,7 +14,19 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #ifndef __CPU_PMC_H
 #define __CPU_PMC_H
 
+#include <sys/types.h>
 #include "cpu/cpu.h"
+#include "model_lat.h"
+
+// upper bound of general purpose counters we program (PERFEVTSEL0-7), and
+// of the counters multiplexed on the available ones
+#define PMC_MAX_HW_CNTRS 8
+// width of the general purpose counters when CPUID does not tell, 48 bits
+// since Sandy Bridge
+#define PMC_DEFAULT_HW_CNTR_MASK ((1ULL << 48) - 1)
+// reads of counters programmed on the processor retried when the thread
+// migrates during the read, before the snapshot is discarded
+#define PMC_SNAPSHOT_READ_ATTEMPTS 3
 
 #define DECLARE_ENABLE_PMC(prefix, name) int prefix##_create_pmc_##name(struct pmc_events_s* events, struct pmc_event_s* event)
 #define DECLARE_CLEAR_PMC(prefix, name) void prefix##_clear_pmc_##name(struct pmc_event_s* event)
@@ -39,25 +51,27 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
   };                                              \
   pmc_events_t prefix##_pmc_events = {            \
     num_hw_cntrs,                                 \
+    PMC_DEFAULT_HW_CNTR_MASK,                     \
     prefix##_known_hw_event,                      \
-    prefix##_known_event                          \
+    prefix##_known_event,                         \
+    &pmc_nvmemul_backend                          \
   };
 
 #define ASSIGN_PMC_HW_EVENT_TO_ME(name, local_id)                                   \
   if (assign_pmc_hw_event_to_event(events, name, event, local_id) != E_SUCCESS) {   \
     release_all_pmc_hw_events_of_event(event);                                      \
+    return E_ERROR;                                                                 \
   }
 
-#define READ_MY_HW_EVENT_DIFF(local_id) read_pmc_hw_event_diff(event->hw_events[local_id])
-#define READ_MY_HW_EVENT_CUR(local_id) read_pmc_hw_event_cur(event->hw_events[local_id])
+// derived events only see the counts of the snapshot taken at the start of the epoch
+#define READ_MY_HW_EVENT_DIFF(local_id) tls_pmc_snapshot.diffs[event->hw_events[local_id]->hw_cntr_id]
 
 typedef struct {
     char* name;
     char* os_name; // perf name if known
     uint64_t encoding;
-    int active;
+    int active; // number of derived events using this hardware event
     int hw_cntr_id;
-    uint64_t* last_val; // array holding the last read values per processor (useful to calculate the diff since the last read)
 } pmc_hw_event_t;
 
 typedef struct pmc_event_s {
@@ -72,21 +86,120 @@ typedef struct pmc_event_s {
 
 typedef struct pmc_events_s {
     int num_avail_hw_cntrs; 
+    uint64_t hw_cntr_mask; // counters wrap around past this value, see cpu_hw_cntr_width()
     pmc_hw_event_t* known_hw_events;
     pmc_event_t* known_events;
+    struct pmc_backend_s* backend; // how the counters are programmed and read, see latency.pmc_backend
+    pmc_hw_event_t* hw_cntrs[PMC_MAX_HW_CNTRS]; // hardware event counted by each counter, NULL when free
+    int multiplex; // more counters than available ones, see pmc_set_multiplex()
+    int num_pinned_hw_cntrs; // counters counting all the time when multiplexed
+    int num_hw_cntr_sets; // sets the other counters are rotated in
 } pmc_events_t;
 
+// Counts of every active counter since the previous snapshot of the thread,
+// indexed by counter. Reading the counters once per epoch lets any number of
+// derived events share them.
+typedef struct {
+    uint64_t diffs[PMC_MAX_HW_CNTRS];
+} pmc_snapshot_t;
+
+extern __thread pmc_snapshot_t tls_pmc_snapshot;
+
+// A thread's view of the counters: the values it read at its last snapshot
+// and the counters the backend opened for it, if any. Counters programmed on
+// the processor only make sense on the one they were read on.
+//
+// With backends that time their counters, a counter the kernel only ran
+// part of the time it was enabled has its counts scaled by enabled over
+// running time.
+//
+// With multiplexed counters, only the pinned ones and one set of the others
+// count during an epoch, the next set counts during the next epoch. A set
+// that did not count has its counts estimated from those of the last epoch
+// it counted, scaled by the enabled time of the counters that did count.
+typedef struct {
+    uint64_t last_val[PMC_MAX_HW_CNTRS];
+    int cpu_id; // processor of the last snapshot, -1 before the first one
+    void* counters; // backend state of the thread, NULL when the backend has none
+    int hw_cntr_set; // set of multiplexed counters counting since the last snapshot
+    uint64_t last_enabled[PMC_MAX_HW_CNTRS]; // times of the last snapshot, timed backends only
+    uint64_t last_running[PMC_MAX_HW_CNTRS];
+    uint64_t running_diffs[PMC_MAX_HW_CNTRS]; // counts of the last epoch each counter counted
+    uint64_t running_time[PMC_MAX_HW_CNTRS]; // and its enabled time during that epoch, 0 if none yet
+} pmc_thread_t;
+
+/**
+ * Counter backend. The nvmemul backend programs the counters of every
+ * processor through the kernel module and reads them with rdpmc. The perf
+ * backend opens a group of counters per thread with perf_event_open, which
+ * the kernel saves across context switches, and reads them with rdpmc
+ * through the perf mmap page. The papi backend is built with PAPI_SUPPORT.
+ */
+typedef struct pmc_backend_s {
+    const char* name;
+    int per_thread; // counts follow the thread across context switches and migrations
+    int (*init)(pmc_events_t* events);
+    void (*shutdown)();
+    // called once per hardware event when a derived event first needs it
+    int (*enable_hw_event)(pmc_events_t* events, pmc_hw_event_t* event);
+    // called by the thread itself once all the events are enabled
+    int (*open_thread)(pmc_events_t* events, pmc_thread_t* thread, pid_t tid);
+    void (*close_thread)(pmc_events_t* events, pmc_thread_t* thread);
+    // fills vals with the current value of each active counter, by counter
+    void (*read)(pmc_events_t* events, pmc_thread_t* thread, uint64_t* vals);
+    // optional, fills the time each active counter has been enabled and
+    // running for, by counter, as of the last read, in a unit of the backend
+    void (*read_times)(pmc_events_t* events, pmc_thread_t* thread, uint64_t* enabled, uint64_t* running);
+    // optional, stops the multiplexed counters of the thread's current set
+    // and starts those of set; without it and read_times counters are not
+    // multiplexed
+    int (*switch_set)(pmc_events_t* events, pmc_thread_t* thread, int set);
+} pmc_backend_t;
+
+extern pmc_backend_t pmc_nvmemul_backend;
+extern pmc_backend_t pmc_perf_backend;
+extern pmc_backend_t pmc_sim_backend;
+#ifdef PAPI_SUPPORT
+extern pmc_backend_t pmc_papi_backend;
+#endif
+
+long long rdpmc(int counter);
+
+int pmc_set_backend(pmc_events_t* events, const char* name);
+int pmc_set_multiplex(pmc_events_t* events, int num_pinned_hw_cntrs);
+void pmc_shutdown(pmc_events_t* events);
+int pmc_open_thread(pmc_events_t* events, pmc_thread_t* thread, pid_t tid);
+void pmc_close_thread(pmc_events_t* events, pmc_thread_t* thread);
+
 pmc_hw_event_t* enable_pmc_hw_event(pmc_events_t* events, const char* name);
 void disable_pmc_hw_event(pmc_events_t* events, const char* name);
 void clear_pmc_hw_event(pmc_hw_event_t* event);
-uint64_t read_pmc_hw_event_cur(pmc_hw_event_t* event);
-uint64_t read_pmc_hw_event_diff(pmc_hw_event_t* event);
+void read_pmc_snapshot(pmc_events_t* events, pmc_thread_t* thread);
 int assign_pmc_hw_event_to_event(pmc_events_t* events, const char* name, pmc_event_t* event, int local_id);
 void release_all_pmc_hw_events_of_event(pmc_event_t* event);
 
 pmc_event_t* enable_pmc_event(cpu_model_t* cpu, const char* name);
 void disable_pmc_event(cpu_model_t* cpu, const char* name);
 
+// Counters that may be assigned, more than the available ones when multiplexed
+static inline int pmc_num_hw_cntrs(pmc_events_t* events)
+{
+    return events->multiplex ? PMC_MAX_HW_CNTRS : events->num_avail_hw_cntrs;
+}
+
+// Set of a counter, -1 when pinned. The pinned counters come first, the
+// others are rotated in sets as wide as the rest of the available counters.
+static inline int pmc_hw_cntr_set(pmc_events_t* events, int hw_cntr_id)
+{
+    if (!events->multiplex) {
+        return 0;
+    }
+    if (hw_cntr_id < events->num_pinned_hw_cntrs) {
+        return -1;
+    }
+    return (hw_cntr_id - events->num_pinned_hw_cntrs) / (events->num_avail_hw_cntrs - events->num_pinned_hw_cntrs);
+}
+
 static inline void clear_pmc_event(pmc_event_t* event)
 {
     event->clear(event);
@@ -101,4 +214,18 @@ static inline uint64_t read_pmc_event(pmc_event_t* event)
     return ret;
 }
 
+// See llc_writebacks(). The LLC misses are counted by num_llc_miss_ids
+// hardware events of the derived event from local id llc_miss_id on.
+static inline uint64_t read_llc_writebacks(pmc_event_t* event, int l2_dirty_id, int llc_hit_id,
+                                           int llc_miss_id, int num_llc_miss_ids)
+{
+    uint64_t llc_miss_diff = 0;
+    int i;
+
+    for (i = llc_miss_id; i < llc_miss_id + num_llc_miss_ids; i++) {
+        llc_miss_diff += READ_MY_HW_EVENT_DIFF(i);
+    }
+    return llc_writebacks(READ_MY_HW_EVENT_DIFF(l2_dirty_id), llc_miss_diff, READ_MY_HW_EVENT_DIFF(llc_hit_id));
+}
+
 #endif /* __CPU_PMC_H */
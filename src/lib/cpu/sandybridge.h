@@ -14,11 +14,12 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #ifndef __CPU_SANDYBRIDGE_H
 #define __CPU_SANDYBRIDGE_H
 
-#include <math.h>
 #include "thread.h"
 #include "cpu/pmc.h"
 #include "debug.h"
 
+extern __thread uint64_t tls_nvm_line_reads;
+
 // Perfmon2 is a library that provides a generic interface to access the PMU. It also comes with
 // applications to list all available performance events with their architecutre specific 
 // detailed description and translate them to their respective event code. showevtinfo application can 
@@ -30,11 +31,16 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
   ACTION("CYCLE_ACTIVITY:STALLS_L2_PENDING", NULL, 0x55305a3)                                              \
   ACTION("MEM_LOAD_UOPS_MISC_RETIRED:LLC_MISS", NULL, 0x5302d4)                                            \
   ACTION("MEM_LOAD_UOPS_RETIRED:L3_HIT", NULL, 0x5304d1)                                                   \
-  ACTION("INSTRUCTION_RETIRED", NULL, 0x5300c0)               
+  ACTION("INSTRUCTION_RETIRED", NULL, 0x5300c0)                                                            \
+  ACTION("L2_LINES_OUT:DIRTY_ALL", NULL, 0x530af2)                                                         \
+  ACTION("OFFCORE_REQUESTS_OUTSTANDING:DEMAND_DATA_RD", NULL, 0x530160)                                    \
+  ACTION("OFFCORE_REQUESTS_OUTSTANDING:CYCLES_WITH_DEMAND_DATA_RD", NULL, 0x1530160)
 
 #undef FOREACH_PMC_EVENT
 #define FOREACH_PMC_EVENT(ACTION, prefix)                                                                  \
-  ACTION(ldm_stall_cycles, prefix)
+  ACTION(ldm_stall_cycles, prefix)                                                                         \
+  ACTION(dram_writebacks, prefix)                                                                          \
+  ACTION(memory_parallelism, prefix)
 
 
 DECLARE_ENABLE_PMC(sandybridge, ldm_stall_cycles)
@@ -58,15 +64,50 @@ DECLARE_READ_PMC(sandybridge, ldm_stall_cycles)
    uint64_t mem_load_uops_misc_retired_llc_miss_diff = READ_MY_HW_EVENT_DIFF(1);
    uint64_t mem_load_uops_retired_l3_hit_diff = READ_MY_HW_EVENT_DIFF(2);
 
-   //return floor(cycle_activity_stalls_l2_pending_diff * (((double) (7*mem_load_uops_misc_retired_llc_miss_diff))/((double)(7*mem_load_uops_misc_retired_llc_miss_diff + mem_load_uops_retired_l3_hit_diff))));
-   uint64_t uden = 7.0 * mem_load_uops_misc_retired_llc_miss_diff + mem_load_uops_retired_l3_hit_diff;
-   if (uden == 0) {
-      return 0;  
-   }
-   double den = uden;
-   double num = 7.0 * mem_load_uops_misc_retired_llc_miss_diff;
+   tls_nvm_line_reads = mem_load_uops_misc_retired_llc_miss_diff;
+
+   return llc_stall_cycles(cycle_activity_stalls_l2_pending_diff, mem_load_uops_misc_retired_llc_miss_diff,
+                           mem_load_uops_retired_l3_hit_diff, L3_FACTOR);
+}
+
+
+DECLARE_ENABLE_PMC(sandybridge, dram_writebacks)
+{
+    ASSIGN_PMC_HW_EVENT_TO_ME("L2_LINES_OUT:DIRTY_ALL", 0);
+    ASSIGN_PMC_HW_EVENT_TO_ME("MEM_LOAD_UOPS_MISC_RETIRED:LLC_MISS", 1);
+    ASSIGN_PMC_HW_EVENT_TO_ME("MEM_LOAD_UOPS_RETIRED:L3_HIT", 2);
+
+    return E_SUCCESS;
+}
+
+DECLARE_CLEAR_PMC(sandybridge, dram_writebacks)
+{
+}
+
+DECLARE_READ_PMC(sandybridge, dram_writebacks)
+{
+   return read_llc_writebacks(event, 0, 2, 1, 1);
+}
+
+
+DECLARE_ENABLE_PMC(sandybridge, memory_parallelism)
+{
+    ASSIGN_PMC_HW_EVENT_TO_ME("OFFCORE_REQUESTS_OUTSTANDING:DEMAND_DATA_RD", 0);
+    ASSIGN_PMC_HW_EVENT_TO_ME("OFFCORE_REQUESTS_OUTSTANDING:CYCLES_WITH_DEMAND_DATA_RD", 1);
+
+    return E_SUCCESS;
+}
+
+DECLARE_CLEAR_PMC(sandybridge, memory_parallelism)
+{
+}
+
+DECLARE_READ_PMC(sandybridge, memory_parallelism)
+{
+   uint64_t occupancy_diff = READ_MY_HW_EVENT_DIFF(0);
+   uint64_t busy_cycles_diff = READ_MY_HW_EVENT_DIFF(1);
 
-   return (uint64_t) floorl(cycle_activity_stalls_l2_pending_diff*num/den);
+   return memory_parallelism(occupancy_diff, busy_cycles_diff);
 }
 
 
@@ -13,15 +13,9 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 ***************************************************************************/
 #include "dev.h"
 
-#ifdef PAPI_SUPPORT
-#include "sandybridge-papi.h"
-#include "ivybridge-papi.h"
-#include "haswell-papi.h"
-#else
 #include "sandybridge.h"
 #include "ivybridge.h"
 #include "haswell.h"
-#endif
 
 int intel_xeon_ex_set_throttle_register(pci_regs_t *regs, throttle_type_t throttle_type, uint16_t val)
 {
@@ -80,33 +74,21 @@ int intel_xeon_ex_get_throttle_register(pci_regs_t *regs, throttle_type_t thrott
 
 cpu_model_t cpu_model_intel_xeon_ex = {
     .microarch = SandyBridgeXeon,
-#ifdef PAPI_SUPPORT
-    .pmc_events = {sandybridge_native_events, sandybridge_read_stall_events_local, NULL},
-#else
     .pmc_events = PMC_EVENTS_PTR(sandybridge),
-#endif
     .set_throttle_register = intel_xeon_ex_set_throttle_register,
     .get_throttle_register = intel_xeon_ex_get_throttle_register
 };
 
 cpu_model_t cpu_model_intel_xeon_ex_v2 = {
     .microarch = IvyBridgeXeon,
-#ifdef PAPI_SUPPORT
-    .pmc_events = {ivybridge_native_events, ivybridge_read_stall_events_local, ivybridge_read_stall_events_remote},
-#else
     .pmc_events = PMC_EVENTS_PTR(ivybridge),
-#endif
     .set_throttle_register = intel_xeon_ex_set_throttle_register,
     .get_throttle_register = intel_xeon_ex_get_throttle_register
 };
 
 cpu_model_t cpu_model_intel_xeon_ex_v3 = {
     .microarch = HaswellXeon,
-#ifdef PAPI_SUPPORT
-    .pmc_events = {haswell_native_events, haswell_read_stall_events_local, haswell_read_stall_events_remote},
-#else
     .pmc_events = PMC_EVENTS_PTR(haswell),
-#endif
     .set_throttle_register = intel_xeon_ex_set_throttle_register,
     .get_throttle_register = intel_xeon_ex_get_throttle_register
 };
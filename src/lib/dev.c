@@ -25,7 +25,7 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 // TODO: get this value from the config file
 #define DEV_PATH "/dev/nvmemul"
 
-int set_counter(unsigned int counter_id, unsigned int event_id)
+static int nvmemul_set_counter(unsigned int counter_id, unsigned int event_id)
 {
     int fd;
     int ret;
@@ -47,7 +47,7 @@ int set_counter(unsigned int counter_id, unsigned int event_id)
 }
 
 
-int set_pci(unsigned int bus_id, unsigned int device_id, unsigned int function_id, unsigned int offset, uint16_t val)
+static int nvmemul_set_pci(unsigned int bus_id, unsigned int device_id, unsigned int function_id, unsigned int offset, uint16_t val)
 {
 	int fd; 
     int ret;
@@ -71,7 +71,7 @@ int set_pci(unsigned int bus_id, unsigned int device_id, unsigned int function_i
     return E_SUCCESS;
 }
 
-int get_pci(unsigned int bus_id, unsigned int device_id, unsigned int function_id, unsigned int offset, uint16_t* val)
+static int nvmemul_get_pci(unsigned int bus_id, unsigned int device_id, unsigned int function_id, unsigned int offset, uint16_t* val)
 {
 	int fd; 
     int ret;
@@ -96,4 +96,50 @@ int get_pci(unsigned int bus_id, unsigned int device_id, unsigned int function_i
     return E_SUCCESS;
 }
 
+dev_backend_t dev_nvmemul_backend = {
+    .name = "nvmemul",
+    .set_counter = nvmemul_set_counter,
+    .set_pci = nvmemul_set_pci,
+    .get_pci = nvmemul_get_pci
+};
+
+static dev_backend_t* dev_backend = &dev_nvmemul_backend;
+
+void dev_set_backend(dev_backend_t* backend)
+{
+    DBG_LOG(INFO, "Accessing the device through the %s backend\n", backend->name);
+    dev_backend = backend;
+}
+
+int set_counter(unsigned int counter_id, unsigned int event_id)
+{
+    return dev_backend->set_counter(counter_id, event_id);
+}
+
+int set_pci(unsigned int bus_id, unsigned int device_id, unsigned int function_id, unsigned int offset, uint16_t val)
+{
+    return dev_backend->set_pci(bus_id, device_id, function_id, offset, val);
+}
+
+int get_pci(unsigned int bus_id, unsigned int device_id, unsigned int function_id, unsigned int offset, uint16_t* val)
+{
+    return dev_backend->get_pci(bus_id, device_id, function_id, offset, val);
+}
 
+// E_NOENT when the backend leaves the buses to lspci
+int dev_mc_pci_bus_list(pci_regs_t* bus_id_list[], int max_list_size, int* dev_countp)
+{
+    if (!dev_backend->mc_pci_bus_list) {
+        return E_NOENT;
+    }
+    return dev_backend->mc_pci_bus_list(bus_id_list, max_list_size, dev_countp);
+}
+
+// E_NOENT when the bandwidth has to be measured
+int dev_read_bw(int cpu_node, int mem_node, double* bw)
+{
+    if (!dev_backend->read_bw) {
+        return E_NOENT;
+    }
+    return dev_backend->read_bw(cpu_node, mem_node, bw);
+}
@@ -30,8 +30,28 @@ typedef struct {
     unsigned int channels;
 } pci_regs_t;
 
+// How performance counters and memory controller registers are reached: the
+// kernel module by default, or the simulated device of simulation.enable
+typedef struct dev_backend_s {
+    const char* name;
+    int (*set_counter)(unsigned int counter_id, unsigned int event_id);
+    int (*set_pci)(unsigned int bus_id, unsigned int device_id, unsigned int function_id, unsigned int offset, uint16_t val);
+    int (*get_pci)(unsigned int bus_id, unsigned int device_id, unsigned int function_id, unsigned int offset, uint16_t* val);
+    // optional, the memory-controller pci buses are listed with lspci otherwise
+    int (*mc_pci_bus_list)(pci_regs_t* bus_id_list[], int max_list_size, int* dev_countp);
+    // optional, the read bandwidth is measured otherwise
+    int (*read_bw)(int cpu_node, int mem_node, double* bw);
+} dev_backend_t;
+
+extern dev_backend_t dev_nvmemul_backend;
+extern dev_backend_t dev_sim_backend;
+
+void dev_set_backend(dev_backend_t* backend);
+
 int set_counter(unsigned int counter_id, unsigned int event_id);
 int set_pci(unsigned bus_id, unsigned int device_id, unsigned int function_id, unsigned int offset, uint16_t val);
 int get_pci(unsigned bus_id, unsigned int device_id, unsigned int function_id, unsigned int offset, uint16_t* val);
+int dev_mc_pci_bus_list(pci_regs_t* bus_id_list[], int max_list_size, int* dev_countp);
+int dev_read_bw(int cpu_node, int mem_node, double* bw);
 
 #endif /* __DEVICE_DRIVER_API_H */
@@ -0,0 +1,167 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.  
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "error.h"
+#include "debug.h"
+#include "model.h"
+#include "thread.h"
+#include "epoch_log.h"
+
+typedef struct epoch_log_s {
+    int fd;
+    int num_records;
+    epoch_record_t records[EPOCH_LOG_BUFFER_RECORDS];
+} epoch_log_t;
+
+// raw counts of the current epoch by counter, filled by read_pmc_snapshot()
+__thread uint64_t tls_counter_diffs[EPOCH_LOG_MAX_COUNTERS];
+
+static char* log_path_prefix = NULL;
+static epoch_log_header_t header_template; // fields shared by all the threads
+
+int epoch_log_init(const char* path_prefix, cpu_model_t* cpu)
+{
+    int i;
+    pmc_hw_event_t* event;
+
+    memset(&header_template, 0, sizeof(epoch_log_header_t));
+    header_template.magic = EPOCH_LOG_MAGIC;
+    header_template.version = EPOCH_LOG_VERSION;
+    header_template.record_size = sizeof(epoch_record_t);
+    header_template.read_latency_ns = latency_model.read_latency;
+    header_template.write_latency_ns = latency_model.write_latency;
+    header_template.mlp_aware = latency_model.pmc_memory_parallelism != NULL;
+
+    // counters are assigned once the model has enabled its events
+    for (i = 0; cpu->pmc_events->known_hw_events[i].name; i++) {
+        event = &cpu->pmc_events->known_hw_events[i];
+        if (event->active && event->hw_cntr_id < EPOCH_LOG_MAX_COUNTERS) {
+            strncpy(header_template.counter_names[event->hw_cntr_id], event->name, EPOCH_LOG_NAME_LEN - 1);
+        }
+    }
+
+    if (!(log_path_prefix = strdup(path_prefix))) {
+        return E_NOMEM;
+    }
+
+    DBG_LOG(INFO, "Recording epochs to %s.<tid>\n", log_path_prefix);
+    return E_SUCCESS;
+}
+
+int epoch_log_enabled()
+{
+    return log_path_prefix != NULL;
+}
+
+static int epoch_log_write(int fd, const void* buf, size_t len)
+{
+    const char* p = (const char*) buf;
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = write(fd, p, len)) <= 0) {
+            return E_ERROR;
+        }
+        p += n;
+        len -= n;
+    }
+    return E_SUCCESS;
+}
+
+int epoch_log_open(thread_t* thread)
+{
+    char path[4096];
+    epoch_log_t* log;
+    epoch_log_header_t header;
+
+    if (!log_path_prefix) {
+        return E_SUCCESS;
+    }
+    if (!(log = malloc(sizeof(epoch_log_t)))) {
+        return E_NOMEM;
+    }
+
+    snprintf(path, sizeof(path), "%s.%d", log_path_prefix, thread->tid);
+    if ((log->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        DBG_LOG(WARNING, "thread id [%d] cannot open its epoch log %s\n", thread->tid, path);
+        free(log);
+        return E_ERROR;
+    }
+    log->num_records = 0;
+
+    header = header_template;
+    header.tid = thread->tid;
+    header.cpu_id = thread->cpu_id;
+    header.virtual_node_id = thread->virtual_node->node_id;
+    header.remote_stalls = thread->virtual_node->dram_node != thread->virtual_node->nvram_node &&
+                           latency_model.pmc_remote_dram != NULL;
+    header.tsc_mhz = thread->thread_manager->tsc_mhz;
+    header.cpu_speed_mhz = thread->cpu_speed_mhz;
+    header.hw_local_latency_ns = thread->virtual_node->dram_node->latency;
+    header.hw_remote_latency_ns = thread->virtual_node->nvram_node->latency;
+    if (epoch_log_write(log->fd, &header, sizeof(header)) != E_SUCCESS) {
+        close(log->fd);
+        free(log);
+        return E_ERROR;
+    }
+
+    memset(tls_counter_diffs, 0, sizeof(tls_counter_diffs));
+    thread->epoch_log = log;
+    return E_SUCCESS;
+}
+
+static void epoch_log_flush(epoch_log_t* log)
+{
+    if (log->num_records > 0) {
+        // write() may be called from the epoch signal handler
+        if (epoch_log_write(log->fd, log->records, log->num_records * sizeof(epoch_record_t)) != E_SUCCESS) {
+            DBG_LOG(WARNING, "Failed to write %d epoch records\n", log->num_records);
+        }
+        log->num_records = 0;
+    }
+}
+
+// Called by the thread itself at the end of an epoch. Epochs do not nest, so
+// the buffer is never appended to by the signal handler and the thread at once.
+void epoch_log_append(thread_t* thread, const epoch_record_t* record)
+{
+    epoch_log_t* log = thread->epoch_log;
+
+    log->records[log->num_records++] = *record;
+    if (log->num_records == EPOCH_LOG_BUFFER_RECORDS) {
+        epoch_log_flush(log);
+    }
+    memset(tls_counter_diffs, 0, sizeof(tls_counter_diffs));
+}
+
+void epoch_log_close(thread_t* thread)
+{
+    epoch_log_t* log = thread->epoch_log;
+
+    if (!log) {
+        return;
+    }
+
+    // an epoch closed by a late signal must not append any more
+    thread->epoch_log = NULL;
+    __asm__ __volatile__ ("" ::: "memory");
+
+    epoch_log_flush(log);
+    close(log->fd);
+    free(log);
+}
@@ -0,0 +1,79 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.  
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __EPOCH_LOG_H
+#define __EPOCH_LOG_H
+
+#include <stdint.h>
+
+/**
+ * \file
+ *
+ * Binary log of the inputs of the latency model, one file per thread named
+ * <latency.epoch_log>.<tid>. A file holds an epoch_log_header_t followed by
+ * one epoch_record_t per epoch, in the byte order of the machine that wrote
+ * it. The replay tool in bench/epoch_replay evaluates the model on these
+ * files with other parameters.
+ */
+
+#define EPOCH_LOG_MAGIC 0x474f4c48434f5045ULL // "EPOCHLOG"
+#define EPOCH_LOG_VERSION 1
+#define EPOCH_LOG_MAX_COUNTERS 8
+#define EPOCH_LOG_NAME_LEN 64
+// records buffered by a thread before they are written out
+#define EPOCH_LOG_BUFFER_RECORDS 256
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    int32_t tid;
+    int32_t cpu_id;
+    int32_t virtual_node_id;
+    int32_t remote_stalls; // stall cycles come from the remote_dram event
+    int32_t tsc_mhz;
+    int32_t cpu_speed_mhz;
+    int32_t hw_local_latency_ns; // DRAM and NVM latency of the thread's virtual node
+    int32_t hw_remote_latency_ns;
+    int32_t read_latency_ns; // emulated target latencies
+    int32_t write_latency_ns;
+    int32_t mlp_aware;
+    int32_t reserved;
+    char counter_names[EPOCH_LOG_MAX_COUNTERS][EPOCH_LOG_NAME_LEN]; // event counted by each counter, empty if unused
+} epoch_log_header_t;
+
+typedef struct {
+    uint64_t start; // TSC the previous epoch ended at, after its delay
+    uint64_t end; // TSC the epoch was closed at, before its delay
+    uint64_t counter_diffs[EPOCH_LOG_MAX_COUNTERS]; // raw counts of the epoch by counter
+    uint64_t stall_cycles; // as computed by the model
+    uint64_t writebacks;
+    uint64_t memory_parallelism; // MLP_SHIFT fractional bits
+    uint64_t delay_cycles; // before the overhead discount
+    uint64_t overhead_cycles; // cost of closing this epoch
+} epoch_record_t;
+
+#ifndef EPOCH_LOG_FORMAT_ONLY
+struct thread_s;
+struct cpu_model_s;
+
+extern __thread uint64_t tls_counter_diffs[EPOCH_LOG_MAX_COUNTERS];
+
+int epoch_log_init(const char* path_prefix, struct cpu_model_s* cpu);
+int epoch_log_enabled();
+int epoch_log_open(struct thread_s* thread);
+void epoch_log_append(struct thread_s* thread, const epoch_record_t* record);
+void epoch_log_close(struct thread_s* thread);
+#endif
+
+#endif /* __EPOCH_LOG_H */
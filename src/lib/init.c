@@ -23,6 +23,7 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include "monotonic_timer.h"
 #include "pflush.h"
 #include "stat.h"
+#include "sim.h"
 
 static void init() __attribute__((constructor));
 static void finalize() __attribute__((destructor));
@@ -53,9 +54,9 @@ void finalize() {
     stats_report();
 #endif
     // finalize libraries and release resources
-#ifdef PAPI_SUPPORT
-    pmc_shutdown();
-#endif
+    if (latency_model.enabled && latency_model.pmc_events) {
+        pmc_shutdown(latency_model.pmc_events);
+    }
 
     unset_process_local_rank();
 
@@ -98,7 +99,11 @@ void init()
         goto error;
     }
 
-    if ((cpu = cpu_model()) == NULL) {
+    if (init_simulation(&cfg) != E_SUCCESS) {
+        goto error;
+    }
+
+    if ((cpu = simulation.enabled ? cpu_model_by_name(simulation.cpu) : cpu_model()) == NULL) {
         DBG_LOG(ERROR, "No supported processor found\n");
         goto error;
     }
@@ -116,6 +121,10 @@ void init()
 
         init_thread_manager(&cfg, virtual_topology);
 
+        if (init_delay_injection(&cfg) != E_SUCCESS) {
+            goto error;
+        }
+
 #ifdef USE_STATISTICS
         // statistics makes use of the thread manager and is used by the register_self()
         stats_enable(&cfg);
@@ -143,8 +152,10 @@ void init()
         }
 #endif
         int write_latency;
+        int write_buffer_blocks = DEFAULT_WRITE_BUFFER_BLOCKS;
         __cconfig_lookup_int(&cfg, "latency.write", &write_latency);
-        init_pflush(cpu_speed_mhz(), write_latency);
+        __cconfig_lookup_int(&cfg, "latency.write_buffer_blocks", &write_buffer_blocks);
+        init_pflush(cpu_speed_mhz(), write_latency, latency_model.media_block_bytes, write_buffer_blocks);
     }
 
     end_time = monotonic_time_us();
@@ -17,15 +17,14 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include <pthread.h>
 #include <assert.h>
 #include <signal.h>
+#include <time.h>
+#include <sys/time.h>
 #include "error.h"
 #include "model.h"
 #include "thread.h"
+#include "monotonic_timer.h"
 #include "cpu/cpu.h"
-#ifdef PAPI_SUPPORT
-#include "cpu/pmc-papi.h"
-#else
 #include "cpu/pmc.h"
-#endif
 
 
 // WARNING: Our library MUST directly use the functions we interpose on by 
@@ -38,6 +37,9 @@ int (*__lib_pthread_mutex_lock)(pthread_mutex_t *mutex);
 int (*__lib_pthread_mutex_trylock)(pthread_mutex_t *mutex);
 int (*__lib_pthread_mutex_unlock)(pthread_mutex_t *mutex);
 int (*__lib_pthread_detach)(pthread_t thread);
+int (*__lib_clock_gettime)(clockid_t clk_id, struct timespec *tp);
+int (*__lib_gettimeofday)(struct timeval *tv, void *tz);
+time_t (*__lib_time)(time_t *tloc);
 
 extern inline hrtime_t hrtime_cycles(void);
 extern inline int cycles_to_us(cpu_model_t* cpu, hrtime_t cycles);
@@ -52,10 +54,14 @@ int init_interposition()
     __lib_pthread_mutex_trylock = dlsym(RTLD_NEXT, "pthread_mutex_trylock");
     __lib_pthread_mutex_unlock = dlsym(RTLD_NEXT, "pthread_mutex_unlock");
     __lib_pthread_detach = dlsym(RTLD_NEXT, "pthread_detach");
+    __lib_clock_gettime = dlsym(RTLD_NEXT, "clock_gettime");
+    __lib_gettimeofday = dlsym(RTLD_NEXT, "gettimeofday");
+    __lib_time = dlsym(RTLD_NEXT, "time");
 
     if (__lib_pthread_mutex_lock == NULL || __lib_pthread_mutex_unlock == NULL ||
     	    __lib_pthread_create == NULL || __lib_pthread_mutex_trylock == NULL ||
-    	    __lib_pthread_detach == NULL) {
+    	    __lib_pthread_detach == NULL || __lib_clock_gettime == NULL ||
+    	    __lib_gettimeofday == NULL || __lib_time == NULL) {
     	error = dlerror();
     	DBG_LOG(ERROR, "Interposition failed: %s\n", error != NULL ? error : "unknown reason");
     	return E_ERROR;
@@ -72,6 +78,7 @@ int init_interposition()
 typedef struct {
     void *(*start_routine) (void *);
     void *arg;
+    hrtime_t virtual_time_offset; // the child starts at the virtual time of its parent
 } pthread_create_functor_t;
 
 void* __interposed_start_routine(void* args)
@@ -82,6 +89,7 @@ void* __interposed_start_routine(void* args)
         free(args);
         return NULL;
     }
+    thread_self()->virtual_time_offset = f->virtual_time_offset;
     ret = f->start_routine(f->arg);
     // FIXME: directly calling unregister may miss cases where the 
     // thread terminates prematurely (such as pthread_exit or cancel)
@@ -108,6 +116,7 @@ int pthread_create(pthread_t *thread, const pthread_attr_t *attr,
         pthread_create_functor_t *functor = malloc(sizeof(pthread_create_functor_t));
         functor->arg = arg;
         functor->start_routine = start_routine;
+        functor->virtual_time_offset = thread_self() ? thread_self()->virtual_time_offset : 0;
 
         if ((ret = __lib_pthread_create(thread, attr, __interposed_start_routine, (void*) functor)) != 0) {
             DBG_LOG(ERROR, "call to __lib_pthread_create failed\n");
@@ -139,6 +148,10 @@ int pthread_mutex_lock(pthread_mutex_t *mutex)
         init_interposition();
     err =  __lib_pthread_mutex_lock(mutex);
 
+    if (latency_model.virtual_time && err == 0) {
+        virtual_time_acquire(mutex);
+    }
+
     return err;
 }
 
@@ -159,6 +172,10 @@ int pthread_mutex_trylock(pthread_mutex_t *mutex)
         init_interposition();
     err =  __lib_pthread_mutex_trylock(mutex);
 
+    if (latency_model.virtual_time && err == 0) {
+        virtual_time_acquire(mutex);
+    }
+
     return err;
 }
 
@@ -177,7 +194,88 @@ int pthread_mutex_unlock(pthread_mutex_t *mutex)
     //assert(__lib_pthread_mutex_unlock);
     if (__lib_pthread_mutex_unlock == NULL)
         init_interposition();
+    if (latency_model.virtual_time) {
+        virtual_time_release(mutex);
+    }
     err = __lib_pthread_mutex_unlock(mutex);
 
     return err;
 }
+
+// In virtual time mode the wall clocks are ahead by the delays the calling
+// thread would have spent. Process and thread CPU time clocks are left alone.
+static int is_dilated_clock(clockid_t clk_id)
+{
+    switch (clk_id) {
+        case CLOCK_REALTIME:
+        case CLOCK_MONOTONIC:
+        case CLOCK_MONOTONIC_RAW:
+        case CLOCK_REALTIME_COARSE:
+        case CLOCK_MONOTONIC_COARSE:
+        case CLOCK_BOOTTIME:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// The library's own clock reads, never dilated in virtual time mode. Some of
+// them happen before init() resolves the interposed functions.
+int undilated_clock_gettime(clockid_t clk_id, struct timespec *tp)
+{
+    if (__lib_clock_gettime == NULL)
+        init_interposition();
+    return __lib_clock_gettime(clk_id, tp);
+}
+
+int clock_gettime(clockid_t clk_id, struct timespec *tp)
+{
+    int err;
+    uint64_t ns;
+
+    if (__lib_clock_gettime == NULL)
+        init_interposition();
+    err = __lib_clock_gettime(clk_id, tp);
+
+    if (latency_model.virtual_time && err == 0 && is_dilated_clock(clk_id)) {
+        ns = virtual_time_offset_ns() + tp->tv_nsec;
+        tp->tv_sec += ns / (USECS_PER_SEC * NANOS_PER_USEC);
+        tp->tv_nsec = ns % (USECS_PER_SEC * NANOS_PER_USEC);
+    }
+
+    return err;
+}
+
+int gettimeofday(struct timeval *tv, void *tz)
+{
+    int err;
+    uint64_t us;
+
+    if (__lib_gettimeofday == NULL)
+        init_interposition();
+    err = __lib_gettimeofday(tv, tz);
+
+    if (latency_model.virtual_time && err == 0) {
+        us = virtual_time_offset_ns() / NANOS_PER_USEC + tv->tv_usec;
+        tv->tv_sec += us / USECS_PER_SEC;
+        tv->tv_usec = us % USECS_PER_SEC;
+    }
+
+    return err;
+}
+
+time_t time(time_t *tloc)
+{
+    time_t t;
+
+    if (__lib_time == NULL)
+        init_interposition();
+    t = __lib_time(NULL);
+
+    if (latency_model.virtual_time && t != (time_t) -1) {
+        t += virtual_time_offset_ns() / (USECS_PER_SEC * NANOS_PER_USEC);
+    }
+    if (tloc) *tloc = t;
+
+    return t;
+}
@@ -14,6 +14,10 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #ifndef __INTERPOSE_H
 #define __INTERPOSE_H
 
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+
 
 /**
  * 
@@ -21,7 +25,8 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  * 
  * The emulator intercepts several events of interest. It achieves this
  * by interposing on corresponding functions. 
- * Currently this includes thread creation and POSIX synchronization mechanisms.
+ * Currently this includes thread creation and POSIX synchronization mechanisms,
+ * and in virtual time mode the clocks read by the application.
  */
 
 extern int (*__lib_pthread_create)(pthread_t *thread, const pthread_attr_t *attr,
@@ -30,7 +35,11 @@ extern int (*__lib_pthread_mutex_lock)(pthread_mutex_t *mutex);
 extern int (*__lib_pthread_mutex_trylock)(pthread_mutex_t *mutex);
 extern int (*__lib_pthread_mutex_unlock)(pthread_mutex_t *mutex);
 extern int (*__lib_pthread_detach)(pthread_t thread);
+extern int (*__lib_clock_gettime)(clockid_t clk_id, struct timespec *tp);
+extern int (*__lib_gettimeofday)(struct timeval *tv, void *tz);
+extern time_t (*__lib_time)(time_t *tloc);
 
 int init_interposition();
+int undilated_clock_gettime(clockid_t clk_id, struct timespec *tp);
 
 #endif /* __INTERPOSE_H */
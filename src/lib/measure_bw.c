@@ -29,6 +29,8 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include <numa.h>
 #include "monotonic_timer.h"
 #include "interpose.h"
+#include "dev.h"
+#include "error.h"
 
 
 
@@ -220,6 +222,10 @@ double measure_read_bw(int cpu_node, int mem_node)
     double bw;
     int nthreads = 16;
 
+    if (dev_read_bw(cpu_node, mem_node, &bw) == E_SUCCESS) {
+        return bw;
+    }
+
     array = numa_alloc_onnode(size, mem_node);
     assert(array);
     numa_run_on_node(cpu_node);
@@ -259,7 +265,8 @@ double measure_write_bw(int cpu_node, int mem_node)
 #include <numaif.h>
 #include <omp.h>
 #include "monotonic_timer.h"
-#include "debug.h"
+#include "dev.h"
+#include "error.h"
 
 
 # define N	20000000
@@ -292,8 +299,14 @@ double measure_read_bw(int cpu_node, int mem_node)
     register int	j, k;
     double		t, times[4][NTIMES];
     double *a, *c;
+    double		bw;
     //struct bitmask* membind;
 
+    // a simulated device tells the bandwidth its throttle registers allow
+    if (dev_read_bw(cpu_node, mem_node, &bw) == E_SUCCESS) {
+        return bw;
+    }
+
     /* --- SETUP --- determine precision and check timing --- */
 
     //membind = numa_allocate_nodemask();
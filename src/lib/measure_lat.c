@@ -29,6 +29,7 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include <math.h>
 #include "cpu/cpu.h"
 #include "error.h"
+#include "interpose.h"
 #include "model.h"
 
 #define P  (void)printf
@@ -79,7 +80,7 @@ static uint64_t T(void) {
 #ifndef NDEBUG
     int r =
 #endif
-        gettimeofday(&tv, NULL);
+        __lib_gettimeofday(&tv, NULL);
 
     assert(0 == r);
 
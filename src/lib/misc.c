@@ -15,6 +15,8 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include "errno.h"
 
 
 #include <stdio.h>
@@ -44,3 +46,47 @@ size_t string_to_size(char* str)
     size = factor * val;
     return size;
 }
+
+// Parses "x:y,..." pairs, x in increasing order from 0 and y positive
+int parse_curve(const char* str, int* x, int* y, int max_points, int* points)
+{
+    int n = 0;
+    int xi, yi, len;
+
+    while (*str) {
+        if (n == max_points || 
+                sscanf(str, " %d : %d %n", &xi, &yi, &len) != 2 ||
+                xi < 0 || yi <= 0 ||
+                (n > 0 && xi <= x[n-1])) {
+            return E_INVAL;
+        }
+        x[n] = xi;
+        y[n] = yi;
+        n++;
+        str += len;
+        if (*str == ',') {
+            str++;
+        } else if (*str) {
+            return E_INVAL;
+        }
+    }
+
+    *points = n;
+    return n ? E_SUCCESS : E_INVAL;
+}
+
+// linear interpolation, flat beyond both ends of the curve
+int interpolate_curve(const int* x, const int* y, int n, uint64_t value)
+{
+    int i;
+
+    if (value <= x[0]) {
+        return y[0];
+    }
+    for (i = 1; i < n; i++) {
+        if (value <= x[i]) {
+            return y[i-1] + (int) (((int64_t) (y[i] - y[i-1]) * (int64_t) (value - x[i-1])) / (x[i] - x[i-1]));
+        }
+    }
+    return y[n-1];
+}
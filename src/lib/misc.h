@@ -14,6 +14,11 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #ifndef __MISC_H
 #define __MISC_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 size_t string_to_size(char* str);
+int parse_curve(const char* str, int* x, int* y, int max_points, int* points);
+int interpolate_curve(const int* x, const int* y, int n, uint64_t value);
 
 #endif
@@ -17,34 +17,129 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include "config.h"
 #include "cpu/cpu.h"
 #include "thread.h"
-#ifdef PAPI_SUPPORT
-#include "cpu/pmc-papi.h"
-#else
+#include "read_buffer.h"
 #include "cpu/pmc.h"
-#endif
+
+// counters are programmed through the kernel module unless latency.pmc_backend says otherwise
+#define DEFAULT_PMC_BACKEND "nvmemul"
+// counters kept counting with latency.pmc_multiplex: the stall cycles of
+// LDM_STALL_CYCLES, the first event enabled
+#define MULTIPLEX_PINNED_HW_CNTRS 1
 
 #define MAX_EPOCH_DURATION_US 1000000
 #define MIN_EPOCH_DURATION_US 1
 
+// delays must be this many times the wake up latency to be parked
+#define PARK_THRESHOLD_FACTOR 4
+#define WAKEUP_CALIBRATION_ROUNDS 16
+#define WAKEUP_CALIBRATION_SLEEP_US 20
+
+#define MAX_LOADED_LATENCY_POINTS 16
+// NVM bandwidth is estimated over windows of this length
+#define BANDWIDTH_WINDOW_US 1000
+// caps the utilization of throttled memory in the queueing estimate of its latency
+#define MAX_THROTTLED_UTILIZATION_PERCENT 95
+#define CACHE_LINE_BYTES 64
+
+#define MAX_INTERFERENCE_POINTS 16
+
+// media blocks the write buffer holds, see latency.write_buffer_blocks
+#define DEFAULT_WRITE_BUFFER_BLOCKS 16
+
+#define MAX_DISTRIBUTION_POINTS 64
+// latencies drawn per epoch at most, their mean stands for all the misses of the epoch
+#define DISTRIBUTION_SAMPLES_PER_EPOCH 16
+
+// quantiles of a distribution tabulated at startup, the epoch draws one of them
+#define DISTRIBUTION_QUANTILE_BITS 12
+#define DISTRIBUTION_QUANTILES (1 << DISTRIBUTION_QUANTILE_BITS)
+// fixed-point precision of the lognormal quantiles, factors of the target latency
+#define DISTRIBUTION_SCALE_SHIFT 16
+
+#define DISTRIBUTION_NONE 0
+#define DISTRIBUTION_LOGNORMAL 1 // around the target read latency
+#define DISTRIBUTION_CDF 2 // empirical, absolute latencies
+
+// read latency distribution of a virtual node
+typedef struct {
+    int type;
+    double sigma; // of the underlying normal distribution, DISTRIBUTION_LOGNORMAL
+    int points; // DISTRIBUTION_CDF
+    double latency_ns[MAX_DISTRIBUTION_POINTS];
+    double probability[MAX_DISTRIBUTION_POINTS]; // cumulative, increasing up to 1
+    // latency in ns (DISTRIBUTION_CDF) or factor of the target latency with
+    // DISTRIBUTION_SCALE_SHIFT fractional bits (DISTRIBUTION_LOGNORMAL) at
+    // each quantile (i + 1/2) / DISTRIBUTION_QUANTILES
+    uint32_t quantiles[DISTRIBUTION_QUANTILES];
+} latency_distribution_t;
+
+#define MAX_TIER_NAME 32
+// sampled miss addresses processed at once at the end of an epoch
+#define READ_SAMPLE_BATCH 256
+
+// NVM bandwidth of a virtual node, fed by all its threads at the end of their epochs
+typedef struct {
+    volatile hrtime_t window_start; // TSC
+    volatile uint64_t window_bytes;
+    volatile uint64_t bandwidth_mbps; // measured over the last complete window
+} node_bandwidth_t;
+
+// memory tier of latency.tiers, allocated from with pmalloc_tier()
+typedef struct {
+    char name[MAX_TIER_NAME];
+    int physical_node;
+    int read_latency;
+    int write_latency;
+    int bandwidth_mbps; // reads slow down past it, 0 when not limited
+    int* hw_latency; // of the physical node seen from each virtual node
+    node_bandwidth_t bandwidth; // estimated from the sampled misses of all the threads
+} nvm_tier_t;
+
+// mutexes are hashed into this many release timestamps in virtual time mode
+#define VIRTUAL_TIME_LOCK_BUCKETS 1024
+
 typedef struct {
 	int enabled;
     int read_latency;
     int write_latency;
     int inject_delay;
+    int virtual_time; // delays advance the thread's clocks instead of stalling it
 #ifdef CALIBRATION_SUPPORT
     int calibration;
 #endif
-#ifdef PAPI_SUPPORT
-    read_stalls_t pmc_stall_local;
-    read_stalls_t pmc_stall_remote;
-#else
+    pmc_events_t* pmc_events; // counters of the events below, read once per epoch
     pmc_event_t* pmc_stall_cycles;
     pmc_event_t* pmc_remote_dram;
+    pmc_event_t* pmc_dram_writebacks; // optional, enables write latency emulation
+    pmc_event_t* pmc_memory_parallelism; // optional, scales read delays down by the overlap of misses
     int process_local_rank;
     int max_local_processe_ranks;
-#endif
 
     double stalls_calibration_factor;
+    hrtime_t wakeup_latency_cycles; // median clock_nanosleep() wake up delay seen at startup
+    hrtime_t park_threshold_cycles; // delays from this long are parked, 0 means always spin
+    // loaded latency curve, target read latency (ns) as a function of NVM bandwidth (MB/s)
+    int loaded_latency_points; // 0 means the target read latency is constant
+    int loaded_bandwidth_mbps[MAX_LOADED_LATENCY_POINTS];
+    int loaded_latency_ns[MAX_LOADED_LATENCY_POINTS];
+    node_bandwidth_t* node_bandwidth; // one per virtual node
+    uint64_t throttled_bandwidth_mbps; // bandwidth.read when throttling is enabled, 0 otherwise
+    // read latency increase (percent of the latency) as a function of the NVM write bandwidth (MB/s)
+    int interference_points; // 0 means reads do not see the writes
+    int interference_bandwidth_mbps[MAX_INTERFERENCE_POINTS];
+    int interference_percent[MAX_INTERFERENCE_POINTS];
+    node_bandwidth_t* node_write_bandwidth; // one per virtual node
+    int media_block_bytes; // NVM internal read and write granularity, 0 when not modeled
+    read_buffer_t* read_buffers; // one per virtual node, NULL when reads are not buffered
+    int read_buffer_latency; // of the misses that hit the read buffer (ns), 0 for the hardware latency
+    int read_sample_period;
+    // tiers of latency.tiers, misses outside their regions see read_latency
+    int num_tiers;
+    nvm_tier_t tiers[MAX_TIERS];
+    latency_distribution_t* distributions; // one per virtual node, NULL when latencies are constant
+    // target read latencies (ns) whose delays are computed but not injected
+    int sweep_points;
+    int sweep_latency_ns[MAX_SWEEP_LATENCIES];
 } latency_model_t;
 
 extern latency_model_t latency_model;
@@ -62,7 +157,15 @@ extern bw_model_t write_bw_model;
 int init_bandwidth_model(config_t* cfg, struct virtual_topology_s* topology);
 int init_latency_model(config_t* cfg, cpu_model_t* cpu, struct virtual_topology_s* virtual_topology);
 void init_thread_latency_model(thread_t *thread);
+int init_delay_injection(config_t* cfg);
 
 void create_latency_epoch();
+void account_nvm_write_lines(uint64_t lines, uint64_t media_blocks, int non_temporal);
+void virtual_time_release(void* sync_object);
+void virtual_time_acquire(void* sync_object);
+uint64_t virtual_time_offset_ns();
+int tier_id(const char* name);
+int tier_physical_node(int tier);
+int tier_write_latency_ns(const void* addr);
 
 #endif /* __MODEL_H */
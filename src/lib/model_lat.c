@@ -11,14 +11,25 @@ should have received a copy of the GNU General Public License along
 with this program; if not, write to the Free Software Foundation,
 Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 ***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <math.h>
 #include "cpu/cpu.h"
 #include "config.h"
 #include "error.h"
+#include "interpose.h"
 #include "thread.h"
 #include "topology.h"
 #include "model.h"
 #include "monotonic_timer.h"
+#include "epoch_log.h"
+#include "measure.h"
+#include "misc.h"
+#include "model_lat.h"
+#include "sim.h"
+#include "tier.h"
 
 /**
  * \file
@@ -32,12 +43,84 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  *
  * Delays are calculated using a simple analytic model that takes input from 
  * performance counters.
+ *
+ * Read delays are proportional to the memory stall cycles of the epoch. Write
+ * delays are charged per cache line estimated to be written back to memory,
+ * each one costing the difference between the target write latency and the 
+ * hardware latency. Write latency emulation requires a processor event 
+ * counting L2 dirty evictions and a free hardware counter, otherwise only 
+ * pflush() emulates write latency.
+ *
+ * With a loaded latency curve (latency.loaded_latency), the target read 
+ * latency follows the NVM bandwidth of the virtual node, estimated from the
+ * lines read from memory by all its threads. If the memory bandwidth is also
+ * throttled, the hardware latency is raised by the queueing the throttling 
+ * causes, which the stall cycles already include.
+ *
+ * Read latencies may also follow a distribution per virtual node 
+ * (latency.distribution), lognormal around the target or an empirical CDF.
+ * Every epoch draws as many latencies as it has misses, up to 
+ * DISTRIBUTION_SAMPLES_PER_EPOCH, and uses their mean as its target.
+ *
+ * Reads behind writes in flight are slower. With a write interference curve
+ * (latency.write_interference), the target read latency is raised by a 
+ * percentage that follows the NVM write bandwidth of the virtual node, made
+ * of the writebacks counted by the epochs, pflush() and the non-temporal 
+ * stores the application declares.
+ *
+ * NVM modules keep the media blocks last read in a buffer (latency.read_buffer_blocks).
+ * The addresses of sampled LLC misses feed an LRU of media blocks per virtual
+ * node, and the share of the samples of an epoch found in it is the share of
+ * its misses served at latency.read_buffer_latency instead of the target.
+ *
+ * Several memory tiers with their own latencies may be emulated at once 
+ * (latency.tiers). Applications allocate from a tier with pmalloc_tier(), 
+ * and the stall cycles of an epoch are split among the tiers by the share of
+ * the sampled misses that fall in their allocations. When NVM is remote, the
+ * stall cycles of the remote and of the local DRAM are split apart, among 
+ * the samples served by each as told by their data source. The other misses
+ * see the target read latency.
+ *
+ * Optionally (latency.mlp_aware), read delays are divided by the average 
+ * number of misses outstanding at the same time, as overlapping misses wait
+ * for the extra latency together rather than one after the other.
+ *
+ * Delays shorter than a few times the wake up latency of clock_nanosleep() 
+ * are injected by spinning. Longer ones park the thread and spin only the 
+ * last part. The time spent beyond the delay is discounted from the next 
+ * epoch.
+ *
+ * In virtual time mode (latency.virtual_time), delays are not injected but
+ * added to a per-thread offset which the interposed clock_gettime(), 
+ * gettimeofday() and time() add to the time they return. The application 
+ * then observes NVM timing while running at DRAM speed. Each thread keeps 
+ * its own offset, as threads accumulate different delays. To keep the order 
+ * seen across synchronization points, a mutex release records the virtual 
+ * time of the releasing thread and the next owner's clock is moved forward 
+ * to it if it lags behind. A child thread starts at its parent's virtual 
+ * time. Reading the TSC directly is not dilated.
+ *
+ * A latency sweep (latency.sweep) evaluates the constant read delay of 
+ * several more target latencies on the stall cycles of every epoch without 
+ * injecting them. The statistics report projects each thread's runtime at 
+ * these latencies by swapping the delay actually requested for theirs.
+ *
+ * The inputs of every epoch can be recorded (latency.epoch_log) and the 
+ * model evaluated again offline with other parameters, see epoch_log.h.
+ *
+ * Events needing more counters than the processor has can share them 
+ * (latency.pmc_multiplex): the stall cycles keep their counter and the other
+ * counters take turns, one set per epoch, see pmc_thread_t. The counts of 
+ * the sets not counting in an epoch are estimated from their last epoch.
  */ 
 
 
 
 latency_model_t latency_model;
 
+// virtual time (TSC) of the last release of the mutexes hashed to each bucket
+static volatile hrtime_t virtual_time_lock_stamps[VIRTUAL_TIME_LOCK_BUCKETS];
+
 #pragma GCC push_options
 #pragma GCC optimize ("O0")
 inline hrtime_t hrtime_cycles(void)
@@ -60,18 +143,34 @@ inline hrtime_t cycles_to_us(int cpu_speed_mhz, hrtime_t cycles)
     return (cycles/cpu_speed_mhz);
 }
 
-#pragma GCC push_options
-#pragma GCC optimize ("O0")
-static inline void create_delay_cycles(hrtime_t cycles)
+// Injects a delay of the given TSC cycles and returns by how many cycles the
+// delay was exceeded. Short delays spin; long ones park the thread so that the
+// hyperthread sibling gets the core, waking up early enough to spin the tail.
+static hrtime_t create_delay_cycles(hrtime_t cycles, int tsc_mhz)
 {
-    hrtime_t start, stop;
+    hrtime_t start, end, now;
+    struct timespec wakeup;
+    uint64_t ns;
 
-    start = hrtime_cycles();
-    do {
-        stop = hrtime_cycles();
-    } while (stop - start < cycles);
+    start = hrtime_now();
+    end = start + cycles;
+
+    if (latency_model.park_threshold_cycles && cycles >= latency_model.park_threshold_cycles) {
+        undilated_clock_gettime(CLOCK_MONOTONIC, &wakeup);
+        ns = ((cycles - latency_model.wakeup_latency_cycles) * NANOS_PER_USEC) / tsc_mhz + wakeup.tv_nsec;
+        wakeup.tv_sec += ns / (USECS_PER_SEC * NANOS_PER_USEC);
+        wakeup.tv_nsec = ns % (USECS_PER_SEC * NANOS_PER_USEC);
+        // sleep again if interrupted by a signal, the deadline is absolute
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL) != 0 &&
+               hrtime_now() < end - latency_model.wakeup_latency_cycles);
+    }
+
+    while ((now = hrtime_now()) < end) {
+        __asm__ __volatile__ ("pause" ::: "memory");
+    }
+
+    return now - end;
 }
-#pragma GCC pop_options
 
 /*
 static inline void create_delay_ns(cpu_model_t* cpu, int ns)
@@ -82,6 +181,602 @@ static inline void create_delay_ns(cpu_model_t* cpu, int ns)
 }
 */
 
+// Adds bytes to the traffic of a virtual node; the thread closing a window
+// publishes the bandwidth of that window
+static uint64_t update_node_bandwidth(node_bandwidth_t* node, uint64_t bytes, hrtime_t now, int tsc_mhz)
+{
+    hrtime_t window_start = node->window_start;
+    hrtime_t window_cycles = (hrtime_t) BANDWIDTH_WINDOW_US * tsc_mhz;
+
+    __sync_fetch_and_add(&node->window_bytes, bytes);
+    if (window_start == 0) {
+        __sync_bool_compare_and_swap(&node->window_start, 0, now);
+    } else if (now - window_start >= window_cycles &&
+            __sync_bool_compare_and_swap(&node->window_start, window_start, now)) {
+        bytes = __sync_lock_test_and_set(&node->window_bytes, 0);
+        // bytes per microsecond is MB/s
+        node->bandwidth_mbps = (bytes * tsc_mhz) / (now - window_start);
+    }
+    return node->bandwidth_mbps;
+}
+
+static int init_loaded_latency_model(config_t* cfg, virtual_topology_t* virtual_topology)
+{
+    char* curve;
+    int throttled_bandwidth;
+
+    if (__cconfig_lookup_string(cfg, "latency.loaded_latency", &curve) != CONFIG_TRUE) {
+        return E_SUCCESS;
+    }
+    if (parse_curve(curve, latency_model.loaded_bandwidth_mbps, latency_model.loaded_latency_ns,
+                    MAX_LOADED_LATENCY_POINTS, &latency_model.loaded_latency_points) != E_SUCCESS) {
+        DBG_LOG(WARNING, "Invalid latency.loaded_latency curve \"%s\", using a constant read latency\n", curve);
+        latency_model.loaded_latency_points = 0;
+        return E_SUCCESS;
+    }
+
+    if (!(latency_model.node_bandwidth = calloc(virtual_topology->num_virtual_nodes, sizeof(node_bandwidth_t)))) {
+        return E_NOMEM;
+    }
+
+    // throttled memory queues up as its bandwidth is used, part of the loaded
+    // latency shows up in the stall cycles already
+    if (read_bw_model.enabled &&
+            __cconfig_lookup_int(cfg, "bandwidth.read", &throttled_bandwidth) == CONFIG_TRUE &&
+            throttled_bandwidth > 0) {
+        latency_model.throttled_bandwidth_mbps = throttled_bandwidth;
+    }
+
+    DBG_LOG(INFO, "Loaded latency curve with %d points, memory throttled to %lu MB/s\n",
+            latency_model.loaded_latency_points, latency_model.throttled_bandwidth_mbps);
+    return E_SUCCESS;
+}
+
+// Parses a comma separated list of target read latencies in ns
+static int parse_sweep_latencies(const char* str)
+{
+    int n = 0;
+    int latency, len;
+
+    while (*str) {
+        if (n == MAX_SWEEP_LATENCIES ||
+                sscanf(str, " %d %n", &latency, &len) != 1 || latency <= 0) {
+            return E_INVAL;
+        }
+        latency_model.sweep_latency_ns[n++] = latency;
+        str += len;
+        if (*str == ',') {
+            str++;
+        } else if (*str) {
+            return E_INVAL;
+        }
+    }
+
+    latency_model.sweep_points = n;
+    return n ? E_SUCCESS : E_INVAL;
+}
+
+static int init_latency_sweep(config_t* cfg, virtual_topology_t* virtual_topology)
+{
+    char* sweep;
+    int i, j;
+
+    if (__cconfig_lookup_string(cfg, "latency.sweep", &sweep) != CONFIG_TRUE) {
+        return E_SUCCESS;
+    }
+#ifndef USE_STATISTICS
+    DBG_LOG(WARNING, "latency.sweep needs statistics support, ignored\n");
+    return E_SUCCESS;
+#endif
+    if (parse_sweep_latencies(sweep) != E_SUCCESS) {
+        DBG_LOG(ERROR, "Invalid latency.sweep \"%s\", at most %d latencies in ns are expected\n",
+                sweep, MAX_SWEEP_LATENCIES);
+        latency_model.sweep_points = 0;
+        return E_INVAL;
+    }
+
+    for (i = 0; i < latency_model.sweep_points; i++) {
+        for (j = 0; j < virtual_topology->num_virtual_nodes; j++) {
+            if (latency_model.sweep_latency_ns[i] <= virtual_topology->virtual_nodes[j].nvram_node->latency) {
+                DBG_LOG(ERROR, "Sweep latency (%d) must be greater than the hardware latency of virtual nvram (%d) (virtual node %d)\n",
+                        latency_model.sweep_latency_ns[i], virtual_topology->virtual_nodes[j].nvram_node->latency, j);
+                latency_model.sweep_points = 0;
+                return E_INVAL;
+            }
+        }
+    }
+
+    DBG_LOG(INFO, "Projecting the runtime of %d target read latencies\n", latency_model.sweep_points);
+    return E_SUCCESS;
+}
+
+extern __thread int tls_hw_remote_latency;
+extern __thread uint64_t tls_nvm_line_reads;
+extern __thread uint64_t tls_read_samples;
+extern __thread uint64_t tls_read_buffer_hits;
+extern __thread uint64_t tls_tier_misses[MAX_TIERS];
+extern __thread uint64_t tls_local_read_samples;
+extern __thread uint64_t tls_tier_local_misses[MAX_TIERS];
+
+static int init_write_interference(config_t* cfg, virtual_topology_t* virtual_topology)
+{
+    char* curve;
+    int i;
+
+    if (__cconfig_lookup_string(cfg, "latency.write_interference", &curve) != CONFIG_TRUE) {
+        return E_SUCCESS;
+    }
+    if (parse_curve(curve, latency_model.interference_bandwidth_mbps, latency_model.interference_percent,
+                    MAX_INTERFERENCE_POINTS, &latency_model.interference_points) != E_SUCCESS) {
+        DBG_LOG(ERROR, "Invalid latency.write_interference curve \"%s\"\n", curve);
+        latency_model.interference_points = 0;
+        return E_INVAL;
+    }
+    for (i = 0; i < latency_model.interference_points; i++) {
+        if (latency_model.interference_percent[i] < 100) {
+            DBG_LOG(ERROR, "latency.write_interference must not make reads faster (%d%%)\n",
+                    latency_model.interference_percent[i]);
+            latency_model.interference_points = 0;
+            return E_INVAL;
+        }
+    }
+
+    if (!(latency_model.node_write_bandwidth = calloc(virtual_topology->num_virtual_nodes, sizeof(node_bandwidth_t)))) {
+        return E_NOMEM;
+    }
+    if (!latency_model.pmc_dram_writebacks) {
+        DBG_LOG(WARNING, "No writeback counter, only pflush() and pflush_nt_stores() make up the write traffic\n");
+    }
+
+    DBG_LOG(INFO, "Write interference curve with %d points\n", latency_model.interference_points);
+    return E_SUCCESS;
+}
+
+static int init_read_buffers(config_t* cfg, virtual_topology_t* virtual_topology)
+{
+    int blocks = 0;
+    int i;
+
+    __cconfig_lookup_int(cfg, "latency.read_buffer_blocks", &blocks);
+    if (blocks == 0) {
+        return E_SUCCESS;
+    }
+    if (!latency_model.media_block_bytes) {
+        DBG_LOG(ERROR, "latency.read_buffer_blocks requires latency.media_block_bytes\n");
+        return E_INVAL;
+    }
+    if (blocks < 0 || blocks > MAX_READ_BUFFER_BLOCKS) {
+        DBG_LOG(ERROR, "latency.read_buffer_blocks must be between 1 and %d\n", MAX_READ_BUFFER_BLOCKS);
+        return E_INVAL;
+    }
+
+    __cconfig_lookup_int(cfg, "latency.read_buffer_latency", &latency_model.read_buffer_latency);
+    if (latency_model.read_buffer_latency < 0 || latency_model.read_buffer_latency >= latency_model.read_latency) {
+        DBG_LOG(ERROR, "latency.read_buffer_latency (%d) must be below the target read latency (%d)\n",
+                latency_model.read_buffer_latency, latency_model.read_latency);
+        return E_INVAL;
+    }
+
+    if (!(latency_model.read_buffers = calloc(virtual_topology->num_virtual_nodes, sizeof(read_buffer_t)))) {
+        return E_NOMEM;
+    }
+    for (i = 0; i < virtual_topology->num_virtual_nodes; i++) {
+        read_buffer_init(&latency_model.read_buffers[i], blocks, latency_model.media_block_bytes);
+    }
+
+    DBG_LOG(INFO, "Read buffer of %d media blocks per virtual node\n", blocks);
+    return E_SUCCESS;
+}
+
+// "name:node:read_ns:write_ns[:bandwidth_mbps]"
+static int parse_tier(char* str, nvm_tier_t* tier)
+{
+    char* saveptr;
+    char* name;
+    char* field;
+    char* end;
+    int values[4] = { 0, 0, 0, 0 };
+    int n = 0;
+
+    if (!(name = strtok_r(str, ":", &saveptr)) || strlen(name) >= MAX_TIER_NAME) {
+        return E_INVAL;
+    }
+    while ((field = strtok_r(NULL, ":", &saveptr)) && n < 4) {
+        values[n++] = (int) strtol(field, &end, 10);
+        if (end == field || *end) {
+            return E_INVAL;
+        }
+    }
+    if (field || n < 3) {
+        return E_INVAL;
+    }
+
+    strcpy(tier->name, name);
+    tier->physical_node = values[0];
+    tier->read_latency = values[1];
+    tier->write_latency = values[2];
+    tier->bandwidth_mbps = values[3];
+    if (tier->physical_node < 0 || tier->physical_node > numa_max_node() ||
+            tier->read_latency <= 0 || tier->write_latency <= 0 || tier->bandwidth_mbps < 0) {
+        return E_INVAL;
+    }
+    return E_SUCCESS;
+}
+
+static void free_tiers()
+{
+    int t;
+
+    for (t = 0; t < latency_model.num_tiers; t++) {
+        free(latency_model.tiers[t].hw_latency);
+        latency_model.tiers[t].hw_latency = NULL;
+    }
+    latency_model.num_tiers = 0;
+}
+
+// latency.tiers holds one tier per entry, separated by ';'
+static int init_tiers(config_t* cfg, cpu_model_t* cpu, virtual_topology_t* virtual_topology)
+{
+    char* config;
+    char* str;
+    char* entry;
+    char* saveptr;
+    nvm_tier_t* tier;
+    virtual_node_t* vnode;
+    int t, v;
+
+    if (__cconfig_lookup_string(cfg, "latency.tiers", &config) != CONFIG_TRUE) {
+        return E_SUCCESS;
+    }
+    if (!(str = strdup(config))) {
+        return E_NOMEM;
+    }
+
+    for (entry = strtok_r(str, ";", &saveptr); entry; entry = strtok_r(NULL, ";", &saveptr)) {
+        if (latency_model.num_tiers == MAX_TIERS ||
+                parse_tier(entry, &latency_model.tiers[latency_model.num_tiers]) != E_SUCCESS ||
+                tier_id(latency_model.tiers[latency_model.num_tiers].name) >= 0) {
+            DBG_LOG(ERROR, "Invalid latency.tiers \"%s\", expected up to %d uniquely named "
+                    "name:node:read_ns:write_ns[:bandwidth_mbps] entries\n", config, MAX_TIERS);
+            free(str);
+            latency_model.num_tiers = 0;
+            return E_INVAL;
+        }
+        latency_model.num_tiers++;
+    }
+    free(str);
+
+    for (t = 0; t < latency_model.num_tiers; t++) {
+        tier = &latency_model.tiers[t];
+        if (!(tier->hw_latency = calloc(virtual_topology->num_virtual_nodes, sizeof(int)))) {
+            free_tiers();
+            return E_NOMEM;
+        }
+        for (v = 0; v < virtual_topology->num_virtual_nodes; v++) {
+            vnode = &virtual_topology->virtual_nodes[v];
+            if (tier->physical_node == vnode->nvram_node->node_id) {
+                tier->hw_latency[v] = vnode->nvram_node->latency;
+            } else if (tier->physical_node == vnode->dram_node->node_id) {
+                tier->hw_latency[v] = vnode->dram_node->latency;
+            } else {
+                tier->hw_latency[v] = measure_latency(cpu, vnode->dram_node->node_id, tier->physical_node);
+            }
+            if (tier->read_latency <= tier->hw_latency[v] || tier->write_latency <= tier->hw_latency[v]) {
+                DBG_LOG(ERROR, "Tier %s read (%d) and write (%d) latency must be greater than the hardware "
+                        "latency of node %d (%d) from virtual node %d\n", tier->name, tier->read_latency,
+                        tier->write_latency, tier->physical_node, tier->hw_latency[v], v);
+                free_tiers();
+                return E_INVAL;
+            }
+        }
+        DBG_LOG(INFO, "Tier %s on node %d, read %d ns, write %d ns\n", tier->name, tier->physical_node,
+                tier->read_latency, tier->write_latency);
+    }
+    return E_SUCCESS;
+}
+
+int tier_id(const char* name)
+{
+    int t;
+
+    for (t = 0; t < latency_model.num_tiers; t++) {
+        if (strcmp(latency_model.tiers[t].name, name) == 0) {
+            return t;
+        }
+    }
+    return -1;
+}
+
+int tier_physical_node(int tier)
+{
+    return latency_model.tiers[tier].physical_node;
+}
+
+// Write latency of the tier addr was allocated from, 0 outside the tiers
+int tier_write_latency_ns(const void* addr)
+{
+    int t;
+
+    if (!latency_model.num_tiers || (t = tier_of_address((uintptr_t) addr)) < 0) {
+        return 0;
+    }
+    return latency_model.tiers[t].write_latency;
+}
+
+// Write traffic the PMU does not see, pflush() and non-temporal stores. The
+// lines written reach the media as media_blocks writes. The next epoch of a 
+// thread of the node closes the bandwidth window.
+void account_nvm_write_lines(uint64_t lines, uint64_t media_blocks, int non_temporal)
+{
+    thread_t* thread;
+    int stats_enabled = 0;
+
+#ifdef USE_STATISTICS
+    stats_enabled = get_thread_manager() && get_thread_manager()->stats.enabled;
+#endif
+    // every pflush() comes here, only look the thread up when the lines are used
+    if (!stats_enabled && !latency_model.interference_points) {
+        return;
+    }
+    if (!(thread = thread_self())) {
+        return;
+    }
+#ifdef USE_STATISTICS
+    if (stats_enabled) {
+        if (non_temporal) {
+            thread->stats.nt_store_lines += lines;
+            thread->stats.nt_media_block_writes += media_blocks;
+        } else {
+            thread->stats.flushed_lines += lines;
+            thread->stats.media_block_writes += media_blocks;
+        }
+    }
+#endif
+    if (latency_model.interference_points) {
+        __sync_fetch_and_add(&latency_model.node_write_bandwidth[thread->virtual_node->node_id].window_bytes,
+                             lines * CACHE_LINE_BYTES);
+    }
+}
+
+// Reads "latency_ns cumulative_probability" lines, both increasing, the last
+// probability is taken as 1
+static int parse_distribution_cdf(const char* path, latency_distribution_t* dist)
+{
+    FILE* f;
+    char line[256];
+    double latency, probability;
+    int n = 0;
+    int i;
+
+    if (!(f = fopen(path, "r"))) {
+        DBG_LOG(ERROR, "Cannot open latency distribution %s\n", path);
+        return E_NOENT;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, " %lf %lf", &latency, &probability) != 2) {
+            continue; // comments and blank lines
+        }
+        if (n == MAX_DISTRIBUTION_POINTS || latency <= 0 || probability <= 0 ||
+                (n > 0 && (latency <= dist->latency_ns[n-1] || probability <= dist->probability[n-1]))) {
+            fclose(f);
+            return E_INVAL;
+        }
+        dist->latency_ns[n] = latency;
+        dist->probability[n] = probability;
+        n++;
+    }
+    fclose(f);
+    if (n == 0) {
+        return E_INVAL;
+    }
+
+    for (i = 0; i < n; i++) {
+        dist->probability[i] /= dist->probability[n-1];
+    }
+    dist->points = n;
+    dist->type = DISTRIBUTION_CDF;
+    return E_SUCCESS;
+}
+
+static int parse_distribution(char* str, latency_distribution_t* dist)
+{
+    memset(dist, 0, sizeof(latency_distribution_t));
+    while (*str == ' ') str++;
+
+    if (strncmp(str, "lognormal:", 10) == 0) {
+        if (sscanf(str + 10, "%lf", &dist->sigma) != 1 || dist->sigma <= 0) {
+            return E_INVAL;
+        }
+        dist->type = DISTRIBUTION_LOGNORMAL;
+        return E_SUCCESS;
+    }
+    if (strncmp(str, "cdf:", 4) == 0) {
+        return parse_distribution_cdf(str + 4, dist);
+    }
+    if (strcmp(str, "none") == 0) {
+        return E_SUCCESS;
+    }
+    return E_INVAL;
+}
+
+// Standard normal quantile of p, by bisection of its CDF
+static double normal_quantile(double p)
+{
+    double lo = -40.0, hi = 40.0, z;
+    int i;
+
+    for (i = 0; i < 64; i++) {
+        z = (lo + hi) / 2;
+        if (0.5 * erfc(-z / M_SQRT2) < p) {
+            lo = z;
+        } else {
+            hi = z;
+        }
+    }
+    return (lo + hi) / 2;
+}
+
+// Tabulates the quantiles of the distribution so that the epochs draw
+// latencies with a table lookup and no floating point
+static void tabulate_distribution(latency_distribution_t* dist)
+{
+    double p, q;
+    int i, j;
+
+    for (i = 0; i < DISTRIBUTION_QUANTILES; i++) {
+        p = (i + 0.5) / DISTRIBUTION_QUANTILES;
+        if (dist->type == DISTRIBUTION_LOGNORMAL) {
+            // scaled so that the mean stays the target latency
+            q = exp(dist->sigma * normal_quantile(p) - dist->sigma * dist->sigma / 2) * (1 << DISTRIBUTION_SCALE_SHIFT);
+        } else if (p <= dist->probability[0]) {
+            q = dist->latency_ns[0];
+        } else {
+            // inverse of the empirical CDF, linear between the points
+            for (j = 1; j < dist->points - 1 && p > dist->probability[j]; j++);
+            q = dist->latency_ns[j-1] + (dist->latency_ns[j] - dist->latency_ns[j-1]) *
+                (p - dist->probability[j-1]) / (dist->probability[j] - dist->probability[j-1]);
+        }
+        dist->quantiles[i] = q < UINT32_MAX ? (uint32_t) (q + 0.5) : UINT32_MAX;
+    }
+}
+
+// latency.distribution holds one distribution per virtual node separated by
+// ';', a single one applies to all the nodes
+static int init_latency_distributions(config_t* cfg, virtual_topology_t* virtual_topology)
+{
+    char* config;
+    char* str;
+    char* entry;
+    char* saveptr;
+    int i, n = 0;
+    int num_nodes = virtual_topology->num_virtual_nodes;
+
+    if (__cconfig_lookup_string(cfg, "latency.distribution", &config) != CONFIG_TRUE) {
+        return E_SUCCESS;
+    }
+    if (!(latency_model.distributions = calloc(num_nodes, sizeof(latency_distribution_t)))) {
+        return E_NOMEM;
+    }
+    if (!(str = strdup(config))) {
+        goto error;
+    }
+
+    for (entry = strtok_r(str, ";", &saveptr); entry; entry = strtok_r(NULL, ";", &saveptr)) {
+        if (n == num_nodes || parse_distribution(entry, &latency_model.distributions[n]) != E_SUCCESS) {
+            DBG_LOG(ERROR, "Invalid latency.distribution \"%s\", expected lognormal:<sigma>, cdf:<file> or none "
+                    "for all or each of the %d virtual nodes\n", config, num_nodes);
+            free(str);
+            goto error;
+        }
+        if (latency_model.distributions[n].type != DISTRIBUTION_NONE) {
+            tabulate_distribution(&latency_model.distributions[n]);
+        }
+        n++;
+    }
+    free(str);
+
+    if (n == 1) {
+        for (i = 1; i < num_nodes; i++) {
+            latency_model.distributions[i] = latency_model.distributions[0];
+        }
+    } else if (n != num_nodes) {
+        DBG_LOG(ERROR, "latency.distribution has %d entries for %d virtual nodes\n", n, num_nodes);
+        goto error;
+    }
+
+    DBG_LOG(INFO, "Read latencies follow a distribution\n");
+    return E_SUCCESS;
+
+error:
+    free(latency_model.distributions);
+    latency_model.distributions = NULL;
+    return E_INVAL;
+}
+
+// Quantile of a random draw, from the top bits of the thread's xorshift state
+static inline uint32_t random_quantile(thread_t* thread, latency_distribution_t* dist)
+{
+    uint64_t x = thread->random_state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    thread->random_state = x;
+    return dist->quantiles[x >> (64 - DISTRIBUTION_QUANTILE_BITS)];
+}
+
+static uint64_t sample_latency(thread_t* thread, latency_distribution_t* dist, uint64_t target_latency)
+{
+    if (dist->type == DISTRIBUTION_LOGNORMAL) {
+        return (target_latency * random_quantile(thread, dist)) >> DISTRIBUTION_SCALE_SHIFT;
+    }
+    return random_quantile(thread, dist);
+}
+
+// Delay ratio of an epoch whose reads have the given target and hardware
+// latencies. With a distribution, the target is the mean latency of a few 
+// samples, as many as the epoch has misses up to DISTRIBUTION_SAMPLES_PER_EPOCH,
+// so that epochs with few misses see the tail more often. Misses estimated to
+// hit the read buffer then lower it, and the write traffic of the node 
+// inflates it.
+static uint64_t read_delay_ratio(thread_t* thread, uint64_t target_latency, uint64_t hw_latency)
+{
+    latency_distribution_t* dist;
+    uint64_t samples, i;
+    uint64_t sum = 0;
+
+    if (latency_model.distributions &&
+            (dist = &latency_model.distributions[thread->virtual_node->node_id])->type != DISTRIBUTION_NONE &&
+            tls_nvm_line_reads > 0) {
+        samples = tls_nvm_line_reads < DISTRIBUTION_SAMPLES_PER_EPOCH ? tls_nvm_line_reads : DISTRIBUTION_SAMPLES_PER_EPOCH;
+        for (i = 0; i < samples; i++) {
+            sum += sample_latency(thread, dist, target_latency);
+        }
+        target_latency = sum / samples;
+    }
+
+    // the hit ratio of the last epoch with samples stands for the epochs without
+    if (latency_model.read_buffers && tls_read_samples > 0) {
+        target_latency = (target_latency * (tls_read_samples - tls_read_buffer_hits) +
+                          (latency_model.read_buffer_latency ? latency_model.read_buffer_latency : hw_latency) *
+                          tls_read_buffer_hits) / tls_read_samples;
+    }
+
+    // reads queue up behind the writes in flight
+    if (latency_model.interference_points) {
+        target_latency = (target_latency * interpolate_curve(latency_model.interference_bandwidth_mbps,
+                latency_model.interference_percent, latency_model.interference_points,
+                latency_model.node_write_bandwidth[thread->virtual_node->node_id].bandwidth_mbps)) / 100;
+    }
+
+    return delay_ratio(target_latency, hw_latency);
+}
+
+// Accounts the lines the epoch read from NVM to the bandwidth of the thread's
+// virtual node and returns the delay ratio for the node's current bandwidth.
+static uint64_t loaded_read_delay_ratio(thread_t* thread, uint64_t nvm_line_reads, hrtime_t now)
+{
+    node_bandwidth_t* node = &latency_model.node_bandwidth[thread->virtual_node->node_id];
+    uint64_t hw_latency = tls_hw_remote_latency;
+    uint64_t utilization;
+    int target_latency;
+
+    update_node_bandwidth(node, nvm_line_reads * CACHE_LINE_BYTES, now, thread->thread_manager->tsc_mhz);
+    target_latency = interpolate_curve(latency_model.loaded_bandwidth_mbps, latency_model.loaded_latency_ns,
+                                       latency_model.loaded_latency_points, node->bandwidth_mbps);
+
+    // M/M/1 estimate of the throttled memory latency
+    if (latency_model.throttled_bandwidth_mbps) {
+        utilization = (node->bandwidth_mbps * 100) / latency_model.throttled_bandwidth_mbps;
+        if (utilization > MAX_THROTTLED_UTILIZATION_PERCENT) {
+            utilization = MAX_THROTTLED_UTILIZATION_PERCENT;
+        }
+        hw_latency = (hw_latency * 100) / (100 - utilization);
+    }
+
+    return read_delay_ratio(thread, target_latency, hw_latency);
+}
+
 static int check_target_latency_against_hw_latency(virtual_topology_t* virtual_topology) {
     int status = 0;
     int i;
@@ -109,6 +804,10 @@ static int check_target_latency_against_hw_latency(virtual_topology_t* virtual_t
 int init_latency_model(config_t* cfg, cpu_model_t* cpu, virtual_topology_t* virtual_topology)
 {
 	int i;
+	int mlp_aware = 0;
+	int pmc_multiplex = 0;
+	char* epoch_log;
+	char* pmc_backend = DEFAULT_PMC_BACKEND;
 
     DBG_LOG(INFO, "Initializing latency model\n");
 
@@ -122,19 +821,69 @@ int init_latency_model(config_t* cfg, cpu_model_t* cpu, virtual_topology_t* virt
         return E_INVAL;
     }
 
+    if (init_loaded_latency_model(cfg, virtual_topology) != E_SUCCESS) {
+        return E_ERROR;
+    }
+
+    if (init_latency_sweep(cfg, virtual_topology) != E_SUCCESS) {
+        return E_INVAL;
+    }
+
+    if (init_latency_distributions(cfg, virtual_topology) != E_SUCCESS) {
+        return E_INVAL;
+    }
+
+    __cconfig_lookup_int(cfg, "latency.media_block_bytes", &latency_model.media_block_bytes);
+    if (latency_model.media_block_bytes && (latency_model.media_block_bytes <= CACHE_LINE_BYTES ||
+            (latency_model.media_block_bytes & (latency_model.media_block_bytes - 1)))) {
+        DBG_LOG(WARNING, "latency.media_block_bytes must be a power of two above the cache line size, ignored\n");
+        latency_model.media_block_bytes = 0;
+    }
+
+    if (init_read_buffers(cfg, virtual_topology) != E_SUCCESS) {
+        return E_INVAL;
+    }
+
+    if (init_tiers(cfg, cpu, virtual_topology) != E_SUCCESS) {
+        return E_INVAL;
+    }
+
+    // both the read buffer and the tiers learn from sampled misses
+    if (latency_model.read_buffers || latency_model.num_tiers) {
+        latency_model.read_sample_period = DEFAULT_READ_SAMPLE_PERIOD;
+        __cconfig_lookup_int(cfg, "latency.read_sample_period", &latency_model.read_sample_period);
+        if (latency_model.read_sample_period <= 0) {
+            DBG_LOG(ERROR, "latency.read_sample_period must be positive\n");
+            return E_INVAL;
+        }
+        DBG_LOG(INFO, "One miss in %d sampled\n", latency_model.read_sample_period);
+    }
+
     __cconfig_lookup_bool(cfg, "latency.inject_delay", &latency_model.inject_delay);
     if (!latency_model.inject_delay) {
         DBG_LOG(WARNING, "Latency model is enabled, but delay injection is disabled\n");
     }
 
-#ifdef PAPI_SUPPORT
-    if (pmc_init() != 0) {
-        return E_ERROR;
+    __cconfig_lookup_bool(cfg, "latency.mlp_aware", &mlp_aware);
+    __cconfig_lookup_bool(cfg, "latency.virtual_time", &latency_model.virtual_time);
+    if (latency_model.virtual_time) {
+        DBG_LOG(INFO, "Virtual time mode, delays advance the application clocks\n");
     }
 
-    latency_model.pmc_stall_local = cpu->pmc_events.read_stalls_events_local;
-    latency_model.pmc_stall_remote = cpu->pmc_events.read_stalls_events_remote;
-#else
+    // simulated hardware has no counters to program
+    if (simulation.enabled) {
+        pmc_backend = SIM_PMC_BACKEND;
+    }
+    __cconfig_lookup_string(cfg, "latency.pmc_backend", &pmc_backend);
+    if (pmc_set_backend(cpu->pmc_events, pmc_backend) != E_SUCCESS) {
+        return E_INVAL;
+    }
+    __cconfig_lookup_bool(cfg, "latency.pmc_multiplex", &pmc_multiplex);
+    if (pmc_multiplex && pmc_set_multiplex(cpu->pmc_events, MULTIPLEX_PINNED_HW_CNTRS) != E_SUCCESS) {
+        DBG_LOG(WARNING, "Events are limited to the %d available performance counters\n",
+                cpu->pmc_events->num_avail_hw_cntrs);
+    }
+    latency_model.pmc_events = cpu->pmc_events;
     for (i=0; cpu->pmc_events->known_events[i].name; ++i) {
         // LDM_STALL_CYCLES implementation for each processor is mandatory
         if (strcasecmp(cpu->pmc_events->known_events[i].name, "LDM_STALL_CYCLES") == 0) {
@@ -147,10 +896,20 @@ int init_latency_model(config_t* cfg, cpu_model_t* cpu, virtual_topology_t* virt
                 return E_NOENT;
             }
         }
+        if (mlp_aware && strcasecmp(cpu->pmc_events->known_events[i].name, "MEMORY_PARALLELISM") == 0) {
+            if (!(latency_model.pmc_memory_parallelism = enable_pmc_event(cpu, "MEMORY_PARALLELISM"))) {
+                DBG_LOG(WARNING, "Memory level parallelism is not available, read delays will not be scaled\n");
+            }
+        }
+        if (strcasecmp(cpu->pmc_events->known_events[i].name, "DRAM_WRITEBACKS") == 0) {
+            // write emulation is best effort, it needs one more counter than read emulation
+            if (!(latency_model.pmc_dram_writebacks = enable_pmc_event(cpu, "DRAM_WRITEBACKS"))) {
+                DBG_LOG(WARNING, "Write latency emulation is disabled, only pflush will inject write delays\n");
+            }
+        }
     }
 
     assert(latency_model.pmc_stall_cycles);
-#endif
 
 #ifdef CALIBRATION_SUPPORT
     __cconfig_lookup_bool(cfg, "latency.calibration", &latency_model.calibration);
@@ -159,12 +918,83 @@ int init_latency_model(config_t* cfg, cpu_model_t* cpu, virtual_topology_t* virt
     }
 #endif
 
+    // the writeback counter is optional
+    if (init_write_interference(cfg, virtual_topology) != E_SUCCESS) {
+        return E_INVAL;
+    }
+
+    // the log header lists the counters of the events enabled above
+    if (__cconfig_lookup_string(cfg, "latency.epoch_log", &epoch_log) == CONFIG_TRUE &&
+            epoch_log_init(epoch_log, cpu) != E_SUCCESS) {
+        return E_NOMEM;
+    }
+
+    return E_SUCCESS;
+}
+
+// Measures how late clock_nanosleep() wakes up and derives from it the delay
+// above which parking the thread is worth it. The thread manager must be
+// initialized, delays are measured with its TSC frequency.
+int init_delay_injection(config_t* cfg)
+{
+    int i, j;
+    int park_threshold_us;
+    int mhz = tsc_mhz();
+    hrtime_t start, late;
+    hrtime_t wakeups[WAKEUP_CALIBRATION_ROUNDS];
+    struct timespec wakeup;
+
+    if (mhz <= 0) {
+        return E_ERROR;
+    }
+
+    for (i = 0; i < WAKEUP_CALIBRATION_ROUNDS; i++) {
+        undilated_clock_gettime(CLOCK_MONOTONIC, &wakeup);
+        start = hrtime_now();
+        wakeup.tv_nsec += WAKEUP_CALIBRATION_SLEEP_US * NANOS_PER_USEC;
+        if (wakeup.tv_nsec >= USECS_PER_SEC * NANOS_PER_USEC) {
+            wakeup.tv_sec++;
+            wakeup.tv_nsec -= USECS_PER_SEC * NANOS_PER_USEC;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL);
+        late = hrtime_now() - start;
+        late = late > (hrtime_t) WAKEUP_CALIBRATION_SLEEP_US * mhz ? late - (hrtime_t) WAKEUP_CALIBRATION_SLEEP_US * mhz : 0;
+        // insertion sort, the rounds are few
+        for (j = i; j > 0 && wakeups[j-1] > late; j--) {
+            wakeups[j] = wakeups[j-1];
+        }
+        wakeups[j] = late;
+    }
+    // the median, an occasional later wake up is paid back as overhead by the next epoch
+    latency_model.wakeup_latency_cycles = wakeups[WAKEUP_CALIBRATION_ROUNDS / 2];
+
+    if (__cconfig_lookup_int(cfg, "latency.park_threshold_us", &park_threshold_us) == CONFIG_TRUE) {
+        latency_model.park_threshold_cycles = (hrtime_t) park_threshold_us * mhz;
+        if (latency_model.park_threshold_cycles && 
+                latency_model.park_threshold_cycles <= latency_model.wakeup_latency_cycles) {
+            DBG_LOG(WARNING, "latency.park_threshold_us is below the wake up latency (%lu usec), delays will not be parked\n",
+                    latency_model.wakeup_latency_cycles / mhz);
+            latency_model.park_threshold_cycles = 0;
+        }
+    } else {
+        latency_model.park_threshold_cycles = PARK_THRESHOLD_FACTOR * latency_model.wakeup_latency_cycles;
+    }
+
+    DBG_LOG(INFO, "wake up latency %lu cycles, delays from %lu cycles are parked\n",
+            latency_model.wakeup_latency_cycles, latency_model.park_threshold_cycles);
     return E_SUCCESS;
 }
 
 __thread uint64_t tls_overhead = 0;
 __thread int tls_hw_local_latency = 0;
 __thread int tls_hw_remote_latency = 0;
+__thread uint64_t tls_nvm_line_reads = 0;
+__thread uint64_t tls_write_delay_cycles_per_line = 0;
+__thread uint64_t tls_read_samples = 0; // of the last epoch with any, see latency.read_buffer_blocks
+__thread uint64_t tls_read_buffer_hits = 0;
+__thread uint64_t tls_tier_misses[MAX_TIERS]; // of the same epoch as tls_read_samples
+__thread uint64_t tls_local_read_samples = 0; // served by the local DRAM, of the same epoch
+__thread uint64_t tls_tier_local_misses[MAX_TIERS];
 #ifdef MEMLAT_SUPPORT
 __thread uint64_t tls_global_remote_dram = 0;
 __thread uint64_t tls_global_local_dram = 0;
@@ -172,35 +1002,168 @@ __thread uint64_t tls_global_local_dram = 0;
 
 void init_thread_latency_model(thread_t *thread)
 {
+    int hw_latency = thread->virtual_node->nvram_node->latency;
+#ifdef USE_STATISTICS
+    int i;
+#endif
+
     tls_hw_local_latency = thread->virtual_node->dram_node->latency;
     tls_hw_remote_latency = thread->virtual_node->nvram_node->latency;
+    tls_write_delay_cycles_per_line = write_delay_cycles_per_line(thread->cpu_speed_mhz, latency_model.write_latency,
+                                                                  tls_hw_remote_latency);
+    thread->read_delay_ratio = delay_ratio(latency_model.read_latency, hw_latency);
+    thread->random_state = ((uint64_t) thread->tid * 0x9e3779b97f4a7c15ULL) ^ hrtime_now();
+    if (thread->random_state == 0) {
+        thread->random_state = 1;
+    }
+
+#ifdef USE_STATISTICS
+    for (i = 0; i < latency_model.sweep_points; i++) {
+        thread->sweep_delay_ratio[i] = delay_ratio(latency_model.sweep_latency_ns[i], hw_latency);
+    }
+#endif
+}
+
+// Runs the misses sampled during the epoch through the read buffer of the
+// thread's virtual node and the tier regions
+static void account_read_samples(thread_t* thread, hrtime_t now)
+{
+    read_sample_t batch[READ_SAMPLE_BATCH];
+    uint64_t tier_misses[MAX_TIERS];
+    uint64_t tier_local_misses[MAX_TIERS];
+    uint64_t samples = 0, local_samples = 0, hits = 0;
+    int i, n, t;
+
+    memset(tier_misses, 0, sizeof(tier_misses));
+    memset(tier_local_misses, 0, sizeof(tier_local_misses));
+    do {
+        n = read_sampler_drain(thread, batch, READ_SAMPLE_BATCH);
+        for (i = 0; i < n; i++) {
+            if (latency_model.read_buffers) {
+                hits += read_buffer_access(&latency_model.read_buffers[thread->virtual_node->node_id], batch[i].addr);
+            }
+            local_samples += batch[i].local_dram;
+            if (latency_model.num_tiers && (t = tier_of_address(batch[i].addr)) >= 0) {
+                tier_misses[t]++;
+                tier_local_misses[t] += batch[i].local_dram;
+            }
+        }
+        samples += n;
+    } while (n == READ_SAMPLE_BATCH);
+
+    // every sample stands for read_sample_period misses
+    for (t = 0; t < latency_model.num_tiers; t++) {
+        if (latency_model.tiers[t].bandwidth_mbps) {
+            update_node_bandwidth(&latency_model.tiers[t].bandwidth,
+                                  tier_misses[t] * latency_model.read_sample_period * CACHE_LINE_BYTES,
+                                  now, thread->thread_manager->tsc_mhz);
+        }
+    }
+
+    if (samples > 0) {
+        tls_read_samples = samples;
+        tls_read_buffer_hits = hits;
+        memcpy(tls_tier_misses, tier_misses, sizeof(tier_misses));
+        tls_local_read_samples = local_samples;
+        memcpy(tls_tier_local_misses, tier_local_misses, sizeof(tier_local_misses));
+    }
+#ifdef USE_STATISTICS
+    if (thread->thread_manager->stats.enabled) {
+        thread->stats.read_samples += samples;
+        thread->stats.read_buffer_hits += hits;
+        for (t = 0; t < latency_model.num_tiers; t++) {
+            thread->stats.tier_misses[t] += tier_misses[t];
+        }
+    }
+#endif
+}
+
+// Takes the stall cycles of the misses sampled in the tier regions out of
+// *stall_cycles and returns their read delay. With remote NVM, *stall_cycles
+// only holds the remote stalls, each tier's share of them is taken among the
+// remote samples, and its share of the local_stall_cycles among the local 
+// ones. Otherwise *stall_cycles holds them all and local_stall_cycles is 0.
+static uint64_t tier_read_delay_cycles(thread_t* thread, uint64_t* stall_cycles,
+                                       uint64_t local_stall_cycles, int remote)
+{
+    nvm_tier_t* tier;
+    uint64_t total_stall_cycles = *stall_cycles;
+    uint64_t measured_samples, tier_measured_misses;
+    uint64_t tier_stall_cycles;
+    uint64_t target_latency;
+    uint64_t delay_cycles = 0;
+    int t;
+
+    if (tls_read_samples == 0) {
+        return 0;
+    }
+    measured_samples = remote ? tls_read_samples - tls_local_read_samples : tls_read_samples;
+
+    for (t = 0; t < latency_model.num_tiers; t++) {
+        tier = &latency_model.tiers[t];
+        tier_measured_misses = remote ? tls_tier_misses[t] - tls_tier_local_misses[t] : tls_tier_misses[t];
+        tier_stall_cycles = measured_samples ? (total_stall_cycles * tier_measured_misses) / measured_samples : 0;
+        *stall_cycles -= tier_stall_cycles;
+        if (remote && tls_local_read_samples) {
+            tier_stall_cycles += (local_stall_cycles * tls_tier_local_misses[t]) / tls_local_read_samples;
+        }
+        target_latency = tier->read_latency;
+        // reads queue up past the bandwidth of the tier
+        if (tier->bandwidth_mbps && tier->bandwidth.bandwidth_mbps > (uint64_t) tier->bandwidth_mbps) {
+            target_latency = (target_latency * tier->bandwidth.bandwidth_mbps) / tier->bandwidth_mbps;
+        }
+        delay_cycles += read_delay_cycles(tier_stall_cycles, read_delay_ratio(thread, target_latency,
+                                          tier->hw_latency[thread->virtual_node->node_id]));
+    }
+    return delay_cycles;
 }
 
 void create_latency_epoch()
 {
     uint64_t stall_cycles = 0;
     uint64_t delay_cycles = 0;
-    int hw_latency;
-    int target_latency;
+    uint64_t writebacks = 0;
+    uint64_t write_delay_cycles = 0;
+    uint64_t mlp = 1 << MLP_SHIFT;
+    uint64_t requested_delay_cycles;
+    uint64_t default_stall_cycles;
+    uint64_t local_stall_cycles = 0;
+    uint64_t tier_delay_cycles = 0;
+    int remote;
+    epoch_record_t record;
+#ifdef USE_STATISTICS
+    uint64_t sweep_delay_cycles;
+    int i;
+#endif
     hrtime_t start, stop;
-    double epoch_end;
+    hrtime_t epoch_end;
 
-    start = hrtime_cycles();
+    start = hrtime_now();
 
-    // An epoch may be created by a critical section and the static epoch
-    // may interfere with the current epoch creation. Block the signal here
-    // and unblock it at the end of this function.
-    block_new_epoch();
-
-    // must always be thread_self since we call core specific data through hrtime_cycles
     thread_t* thread = thread_self();
 
+    // An epoch may be created by a critical section and the static epoch
+    // may interfere with the current epoch creation. The signal handler
+    // returns right away while this flag is set.
+    if (thread) {
+        thread->in_epoch = 1;
+        __asm__ __volatile__ ("" ::: "memory");
+    }
+
     if (!reached_min_epoch_duration(thread)) {
     	if (!thread) thread = thread_self();
-    	if (thread) thread->signaled = 0;
-    	unblock_new_epoch();
+    	if (thread) {
+    	    thread->in_epoch = 0;
+    	    thread->signaled = 0;
+    	}
         return;
     }
+    if (!thread) {
+        // just registered by reached_min_epoch_duration()
+        thread = thread_self();
+        thread->in_epoch = 1;
+        __asm__ __volatile__ ("" ::: "memory");
+    }
 
     //DBG_LOG(INFO, "new epoch for thread id [%i]\n", thread->tid);
 
@@ -210,16 +1173,20 @@ void create_latency_epoch()
     }
 #endif
 
-    // this is the generic hardware latency for this thread (it takes into account the current virtual node latencies)
-    hw_latency = thread->virtual_node->nvram_node->latency;
-    target_latency = latency_model.read_latency;
+    // the events below are computed from the counts of this one read
+    read_pmc_snapshot(latency_model.pmc_events, &thread->pmc);
 
     // check if the thread_self is remote (virtual topology where dram != nvram) or local (dram == nvram)
     // on this case, stall cycles will be a proportion of remote memory accesses
-    // TODO: the read pmc method used below must be changed to support PAPI
-    if (thread->virtual_node->dram_node != thread->virtual_node->nvram_node &&
-            latency_model.pmc_remote_dram) {
+    remote = thread->virtual_node->dram_node != thread->virtual_node->nvram_node &&
+             latency_model.pmc_remote_dram;
+    if (remote) {
         stall_cycles = read_pmc_event(latency_model.pmc_remote_dram);
+        // tiers may live on the local DRAM node too, whose stalls the remote event leaves out
+        if (latency_model.num_tiers) {
+            local_stall_cycles = read_pmc_event(latency_model.pmc_stall_cycles);
+            local_stall_cycles = local_stall_cycles > stall_cycles ? local_stall_cycles - stall_cycles : 0;
+        }
 	} else {
 		stall_cycles = read_pmc_event(latency_model.pmc_stall_cycles);
 	}
@@ -230,13 +1197,61 @@ void create_latency_epoch()
     }
 #endif
 
-    delay_cycles = stall_cycles * ((double)(target_latency - hw_latency) / ((double) hw_latency));
+    if (latency_model.read_buffers || latency_model.num_tiers) {
+        account_read_samples(thread, start);
+    }
+
+    // the misses of the tier regions have their own latencies, the others the target one
+    default_stall_cycles = stall_cycles;
+    if (latency_model.num_tiers) {
+        tier_delay_cycles = tier_read_delay_cycles(thread, &default_stall_cycles, local_stall_cycles, remote);
+    }
+
+    if (latency_model.loaded_latency_points) {
+        delay_cycles = read_delay_cycles(default_stall_cycles, loaded_read_delay_ratio(thread, tls_nvm_line_reads, start));
+    } else if (latency_model.distributions || latency_model.read_buffers || latency_model.interference_points) {
+        delay_cycles = read_delay_cycles(default_stall_cycles, read_delay_ratio(thread, latency_model.read_latency, tls_hw_remote_latency));
+    } else {
+        delay_cycles = read_delay_cycles(default_stall_cycles, thread->read_delay_ratio);
+    }
+    delay_cycles += tier_delay_cycles;
+
+    if (latency_model.pmc_memory_parallelism) {
+        mlp = read_pmc_event(latency_model.pmc_memory_parallelism);
+        delay_cycles = overlapped_delay_cycles(delay_cycles, mlp);
+    }
+
+    if (latency_model.pmc_dram_writebacks) {
+        writebacks = read_pmc_event(latency_model.pmc_dram_writebacks);
+        write_delay_cycles = writebacks * tls_write_delay_cycles_per_line;
+        delay_cycles += write_delay_cycles;
+    }
 
-    stop = hrtime_cycles();
+    // the write traffic slows down the reads of the next epochs
+    if (latency_model.interference_points) {
+        update_node_bandwidth(&latency_model.node_write_bandwidth[thread->virtual_node->node_id],
+                              writebacks * CACHE_LINE_BYTES, start, thread->thread_manager->tsc_mhz);
+    }
+
+    stop = hrtime_now();
     tls_overhead += stop - start;
 
-    DBG_LOG(DEBUG, "overhead cycles: %lu; immediate overhead %lu; stall cycles: %lu; delay cycles: %lu\n", tls_overhead, stop - start, stall_cycles, delay_cycles);
+    adapt_epoch_duration(thread, stop - start, delay_cycles);
+
+    DBG_LOG(DEBUG, "overhead cycles: %lu; immediate overhead %lu; stall cycles: %lu; writebacks: %lu; delay cycles: %lu\n", tls_overhead, stop - start, stall_cycles, writebacks, delay_cycles);
 
+    requested_delay_cycles = delay_cycles;
+    if (thread->epoch_log) {
+        record.start = thread->last_epoch_timestamp;
+        record.end = start;
+        memcpy(record.counter_diffs, tls_counter_diffs, sizeof(record.counter_diffs));
+        record.stall_cycles = stall_cycles;
+        record.writebacks = writebacks;
+        record.memory_parallelism = mlp;
+        record.delay_cycles = requested_delay_cycles;
+        record.overhead_cycles = stop - start;
+        epoch_log_append(thread, &record);
+    }
     if (delay_cycles > tls_overhead) {
     	delay_cycles -= tls_overhead;
         tls_overhead = 0;
@@ -253,44 +1268,112 @@ void create_latency_epoch()
 #ifdef USE_STATISTICS
     if (thread->thread_manager->stats.enabled) {
         thread->stats.stall_cycles += stall_cycles;
+        thread->stats.dram_writebacks += writebacks;
+        thread->stats.memory_parallelism += mlp;
+        thread->stats.write_delay_cycles += write_delay_cycles;
         thread->stats.delay_cycles += delay_cycles;
         thread->stats.overhead_cycles = tls_overhead;
+        if (thread->cpu_speed_mhz) {
+            stats_histogram_add(thread->stats.delay_histogram, delay_cycles / thread->cpu_speed_mhz);
+        }
+        if (latency_model.inject_delay) {
+            thread->stats.requested_delay_cycles += requested_delay_cycles;
+        }
+        // what-if delays of the sweep targets, from the same constant model
+        // as latency.read and the same write delay
+        for (i = 0; i < latency_model.sweep_points; i++) {
+            sweep_delay_cycles = read_delay_cycles(stall_cycles, thread->sweep_delay_ratio[i]);
+            if (latency_model.pmc_memory_parallelism) {
+                sweep_delay_cycles = overlapped_delay_cycles(sweep_delay_cycles, mlp);
+            }
+            thread->stats.sweep_delay_cycles[i] += sweep_delay_cycles + write_delay_cycles;
+        }
     }
 #endif
 
-    epoch_end = monotonic_time_us();
+    epoch_end = stop;
 
     DBG_LOG(DEBUG, "injecting delay of %lu cycles (%lu usec) - discounted overhead\n", delay_cycles,
                     cycles_to_us(thread->cpu_speed_mhz, delay_cycles));
     if (delay_cycles && latency_model.inject_delay) {
-        create_delay_cycles(delay_cycles);
+        if (latency_model.virtual_time) {
+            thread->virtual_time_offset += delay_cycles;
+        } else {
+            // oversleeping is discounted from the next epoch like the overhead
+            tls_overhead += create_delay_cycles(delay_cycles, thread->thread_manager->tsc_mhz);
+        }
     }
 
 #ifdef USE_STATISTICS
     if (thread->thread_manager->stats.enabled) {
-    	uint64_t older_epoch_timestamp = thread->stats.last_epoch_timestamp;
-    	uint64_t diff_epoch_timestamp = epoch_end - older_epoch_timestamp;
+    	hrtime_t diff_epoch_timestamp = epoch_end - thread->last_epoch_timestamp;
 
-    	if (diff_epoch_timestamp < thread->stats.shortest_epoch_duration_us) {
-    	    thread->stats.shortest_epoch_duration_us = diff_epoch_timestamp;
+    	if (diff_epoch_timestamp < thread->stats.shortest_epoch_duration_cycles) {
+    	    thread->stats.shortest_epoch_duration_cycles = diff_epoch_timestamp;
     	}
 
-    	if (diff_epoch_timestamp > thread->stats.longest_epoch_duration_us) {
-		    thread->stats.longest_epoch_duration_us = diff_epoch_timestamp;
+    	if (diff_epoch_timestamp > thread->stats.longest_epoch_duration_cycles) {
+		    thread->stats.longest_epoch_duration_cycles = diff_epoch_timestamp;
     	}
 
-    	thread->stats.overall_epoch_duration_us += diff_epoch_timestamp;
-    	thread->stats.last_epoch_timestamp = monotonic_time_us();
-    } else {
-    	// last epoch timestamp must always be updated
-        thread->stats.last_epoch_timestamp = monotonic_time_us();
+    	thread->stats.overall_epoch_duration_cycles += diff_epoch_timestamp;
     }
-#else
-    thread->last_epoch_timestamp = monotonic_time_us();
 #endif
+    // last epoch timestamp must always be updated
+    thread->last_epoch_timestamp = hrtime_now();
+
+    __asm__ __volatile__ ("" ::: "memory");
+    thread->in_epoch = 0;
     // this must be the last step, since this function is called also from the signal handler
     // and the monitor thread sets this flag, we must make sure race conditions are prevented
     thread->signaled = 0;
+}
+
+static inline volatile hrtime_t* virtual_time_lock_stamp(void* sync_object)
+{
+    uintptr_t h = (uintptr_t) sync_object;
+
+    h = (h >> 4) ^ (h >> 16);
+    return &virtual_time_lock_stamps[h % VIRTUAL_TIME_LOCK_BUCKETS];
+}
+
+// Records the virtual time of the calling thread when it releases a mutex.
+// Mutexes sharing a bucket only make their owners' clocks advance sooner.
+void virtual_time_release(void* sync_object)
+{
+    thread_t* thread = thread_self();
+    volatile hrtime_t* stamp;
+    hrtime_t now, old;
+
+    if (!thread) return;
+
+    stamp = virtual_time_lock_stamp(sync_object);
+    now = hrtime_now() + thread->virtual_time_offset;
+    while ((old = *stamp) < now && !__sync_bool_compare_and_swap(stamp, old, now));
+}
+
+// Moves the clock of the calling thread, which just acquired a mutex, forward
+// to the virtual time the mutex was last released at
+void virtual_time_acquire(void* sync_object)
+{
+    thread_t* thread = thread_self();
+    hrtime_t now, stamp;
+
+    if (!thread) return;
+
+    stamp = *virtual_time_lock_stamp(sync_object);
+    now = hrtime_now() + thread->virtual_time_offset;
+    if (stamp > now) {
+        thread->virtual_time_offset += stamp - now;
+    }
+}
+
+// Nanoseconds the clocks of the calling thread are ahead of real time
+uint64_t virtual_time_offset_ns()
+{
+    thread_t* thread = thread_self();
+
+    if (!latency_model.virtual_time || !thread) return 0;
 
-    unblock_new_epoch();
+    return (thread->virtual_time_offset * NANOS_PER_USEC) / thread->thread_manager->tsc_mhz;
 }
@@ -0,0 +1,125 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.  
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __MODEL_LAT_H
+#define __MODEL_LAT_H
+
+#include <stdint.h>
+
+/**
+ * \file
+ *
+ * Fixed-point formulas of the latency model, from the counts of an epoch to
+ * its delay. The derived events, the epoch and the replay tool in 
+ * bench/epoch_replay share them, so that an epoch log replayed with the 
+ * recorded parameters gives back the recorded delays.
+ */
+
+// fixed-point precision of the per-thread delay ratio (target-hw)/hw
+#define DELAY_RATIO_SHIFT 16
+
+// fixed-point precision of the memory level parallelism, the average number of overlapping misses
+#define MLP_SHIFT 8
+
+// fractional bits of the ratios derived events scale counts by
+#define PMC_RATIO_SHIFT 16
+
+// weight of an LLC miss against an LLC hit in the stall cycle estimate
+#define L3_FACTOR 7
+
+// value * num / den for num <= den without floating point, the ratio keeps
+// PMC_RATIO_SHIFT fractional bits so that the product cannot overflow
+static inline uint64_t pmc_scale(uint64_t value, uint64_t num, uint64_t den)
+{
+    if (den == 0) return 0;
+    return (value * ((num << PMC_RATIO_SHIFT) / den)) >> PMC_RATIO_SHIFT;
+}
+
+// value * num / den for any ratio, as long as num * den fits in 64 bits, as
+// for the durations of epochs in nanoseconds or cycles
+static inline uint64_t pmc_extrapolate(uint64_t value, uint64_t num, uint64_t den)
+{
+    if (den == 0) return 0;
+    return (value / den) * num + ((value % den) * num) / den;
+}
+
+// Share of the L2 pending stall cycles due to LLC misses, an LLC miss
+// weighing l3_factor LLC hits
+static inline uint64_t llc_stall_cycles(uint64_t l2_pending, uint64_t llc_misses, uint64_t llc_hits,
+                                        uint64_t l3_factor)
+{
+    return pmc_scale(l2_pending, l3_factor * llc_misses, l3_factor * llc_misses + llc_hits);
+}
+
+// Share of the stall cycles due to remote DRAM, each access weighted by the
+// hardware latency of its node
+static inline uint64_t remote_stall_cycles(uint64_t stall_cycles, uint64_t remote_dram, uint64_t local_dram,
+                                           uint64_t hw_remote_latency, uint64_t hw_local_latency)
+{
+    return pmc_scale(stall_cycles, remote_dram * hw_remote_latency,
+                     remote_dram * hw_remote_latency + local_dram * hw_local_latency);
+}
+
+// Dirty lines evicted from L2 are written back to the LLC. The core PMU cannot see
+// LLC writebacks to memory, so we assume the dirty lines leave the LLC at the same
+// rate loads miss it.
+static inline uint64_t llc_writebacks(uint64_t l2_dirty, uint64_t llc_misses, uint64_t llc_hits)
+{
+    return pmc_scale(l2_dirty, llc_misses, llc_misses + llc_hits);
+}
+
+// Average number of demand reads outstanding beyond L2 while there is at least
+// one, with MLP_SHIFT fractional bits. Each outstanding read contributes its
+// occupancy every cycle, so the ratio of the two counts is the average number
+// of misses that overlap.
+static inline uint64_t memory_parallelism(uint64_t occupancy, uint64_t busy_cycles)
+{
+    if (busy_cycles == 0 || occupancy < busy_cycles) return 1 << MLP_SHIFT;
+    return (occupancy << MLP_SHIFT) / busy_cycles;
+}
+
+// Extra cycles per stall cycle of reads with the given target and hardware
+// latencies, with DELAY_RATIO_SHIFT fractional bits, none when the target is
+// not above the hardware latency
+static inline uint64_t delay_ratio(uint64_t target_latency, uint64_t hw_latency)
+{
+    if (target_latency <= hw_latency) {
+        return 0;
+    }
+    return ((target_latency - hw_latency) << DELAY_RATIO_SHIFT) / hw_latency;
+}
+
+// the epoch computes the delay with a multiplication and a shift only
+static inline uint64_t read_delay_cycles(uint64_t stall_cycles, uint64_t ratio)
+{
+    return (stall_cycles * ratio) >> DELAY_RATIO_SHIFT;
+}
+
+// overlapping misses wait for the extra latency together
+static inline uint64_t overlapped_delay_cycles(uint64_t delay_cycles, uint64_t mlp)
+{
+    return (delay_cycles << MLP_SHIFT) / mlp;
+}
+
+// Delay of each line written back, none unless the target write latency is
+// above the hardware latency
+static inline uint64_t write_delay_cycles_per_line(uint64_t cpu_speed_mhz, uint64_t write_latency,
+                                                   uint64_t hw_latency)
+{
+    if (write_latency <= hw_latency) {
+        return 0;
+    }
+    return (cpu_speed_mhz * (write_latency - hw_latency)) / 1000;
+}
+
+#endif /* __MODEL_LAT_H */
@@ -4,6 +4,7 @@
 
 #include <unistd.h>
 #include "monotonic_timer.h"
+#include "interpose.h"
 
 #if _POSIX_TIMERS > 0 && defined(_POSIX_MONOTONIC_CLOCK)
   // If we have it, use clock_gettime and CLOCK_MONOTONIC.
@@ -13,14 +14,14 @@
   double monotonic_time() {
     struct timespec time;
     // Note: Make sure to link with -lrt to define clock_gettime.
-    clock_gettime(CLOCK_MONOTONIC, &time);
+    undilated_clock_gettime(CLOCK_MONOTONIC, &time);
     return ((double) time.tv_sec) + ((double) time.tv_nsec / (NANOS_PER_SECF));
   }
 
   double monotonic_time_us() {
 	  struct timespec time;
 	  // Note: Make sure to link with -lrt to define clock_gettime.
-	  clock_gettime(CLOCK_MONOTONIC, &time);
+	  undilated_clock_gettime(CLOCK_MONOTONIC, &time);
 	  return ((double) (time.tv_sec * USECS_PER_SEC)) + ((double) time.tv_nsec / NANOS_PER_USECF);
   }
 
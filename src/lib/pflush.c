@@ -12,11 +12,10 @@ with this program; if not, write to the Free Software Foundation,
 Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 ***************************************************************************/
 #include "pflush.h"
+#include "model.h"
 
 #include <stdint.h>
 
-typedef uint64_t hrtime_t;
-
 #if defined(__i386__)
 
 static inline unsigned long long asm_rdtsc(void)
@@ -67,11 +66,42 @@ static inline unsigned long long asm_rdtscp(void)
 
 static int global_cpu_speed_mhz = 0;
 static int global_write_latency_ns = 0;
+static int global_media_block_shift = 0; // 0 when media blocks are not modeled
+static int global_write_buffer_blocks = 0;
+
+// Media blocks recently written by this thread, a flush to one of them is
+// combined with the pending write of the block and costs no media write
+static __thread uint64_t tls_write_buffer[MAX_WRITE_BUFFER_BLOCKS];
+static __thread int tls_write_buffer_next = 0;
 
-void init_pflush(int cpu_speed_mhz, int write_latency_ns)
+void init_pflush(int cpu_speed_mhz, int write_latency_ns, int media_block_bytes, int write_buffer_blocks)
 {
     global_cpu_speed_mhz = cpu_speed_mhz;
     global_write_latency_ns = write_latency_ns;
+
+    if (media_block_bytes > CACHE_LINE_BYTES && write_buffer_blocks > 0) {
+        global_media_block_shift = 63 - __builtin_clzll((uint64_t) media_block_bytes);
+        global_write_buffer_blocks = write_buffer_blocks < MAX_WRITE_BUFFER_BLOCKS ?
+                                     write_buffer_blocks : MAX_WRITE_BUFFER_BLOCKS;
+    }
+}
+
+// Returns whether the line joins a media block still in the write buffer,
+// otherwise the block replaces the oldest one
+static inline int write_buffer_hit(uint64_t *addr)
+{
+    // block numbers are stored plus one, 0 is an empty entry
+    uint64_t block = ((uintptr_t) addr >> global_media_block_shift) + 1;
+    int i;
+
+    for (i = 0; i < global_write_buffer_blocks; i++) {
+        if (tls_write_buffer[i] == block) {
+            return 1;
+        }
+    }
+    tls_write_buffer[tls_write_buffer_next] = block;
+    tls_write_buffer_next = (tls_write_buffer_next + 1) % global_write_buffer_blocks;
+    return 0;
 }
 
 inline hrtime_t cycles_to_ns(int cpu_speed_mhz, hrtime_t cycles)
@@ -109,7 +139,20 @@ emulate_latency_ns(int ns)
 void
 pflush(uint64_t *addr)
 {
-    if (global_write_latency_ns == 0) {
+    int hit = global_media_block_shift && write_buffer_hit(addr);
+    int write_latency_ns = tier_write_latency_ns(addr);
+
+    account_nvm_write_lines(1, hit ? 0 : 1, 0);
+
+    if (write_latency_ns == 0) {
+        write_latency_ns = global_write_latency_ns;
+    }
+    if (write_latency_ns == 0) {
+        return;
+    }
+    if (hit) {
+        // combined with the pending media write
+        asm_clflush(addr);
         return;
     }
 
@@ -120,9 +163,19 @@ pflush(uint64_t *addr)
     start = asm_rdtscp();
     asm_clflush(addr);  
     stop = asm_rdtscp();
-    int to_insert_ns = global_write_latency_ns - cycles_to_ns(global_cpu_speed_mhz, stop-start);
+    int to_insert_ns = write_latency_ns - cycles_to_ns(global_cpu_speed_mhz, stop-start);
     if (to_insert_ns <= 0) {
         return;
     }
     emulate_latency_ns(to_insert_ns);
 }
+
+void
+pflush_nt_stores(size_t bytes)
+{
+    uint64_t block_bytes = global_media_block_shift ? 1ULL << global_media_block_shift : CACHE_LINE_BYTES;
+
+    // streaming stores fill whole media blocks
+    account_nvm_write_lines((bytes + CACHE_LINE_BYTES - 1) / CACHE_LINE_BYTES,
+                            (bytes + block_bytes - 1) / block_bytes, 1);
+}
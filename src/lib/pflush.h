@@ -23,18 +23,34 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
  */
 
 #include <stdint.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-void init_pflush(int cpu_speed_mhz, int write_latency_ns);
+// the write buffer holds this many media blocks at most
+#define MAX_WRITE_BUFFER_BLOCKS 64
+
+void init_pflush(int cpu_speed_mhz, int write_latency_ns, int media_block_bytes, int write_buffer_blocks);
 
 /**
  * \brief Flush the cacheline containing address addr.
+ *
+ * When media blocks are modeled (latency.media_block_bytes), a flush to a
+ * block among the last latency.write_buffer_blocks ones written by the 
+ * thread is combined with it and does not pay the write latency again.
  */
 void pflush(uint64_t *addr);
 
+/**
+ * \brief Account non-temporal stores of the given size to NVM.
+ *
+ * Non-temporal stores bypass the caches, hence the writeback counters. 
+ * Declaring them lets reads see their interference.
+ */
+void pflush_nt_stores(size_t bytes);
+
 #ifdef __cplusplus
 }
 #endif
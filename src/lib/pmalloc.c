@@ -14,7 +14,10 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include <numa.h>
 #include "topology.h"
 #include "pmalloc.h"
+#include "error.h"
 #include "thread.h"
+#include "model.h"
+#include "tier.h"
 #include "debug.h"
 
 // pmalloc should be implemented as a separate library
@@ -45,12 +48,38 @@ void* pmalloc(size_t size)
     return NULL;
 }
 
+void* pmalloc_tier(size_t size, const char* tier)
+{
+    int id = tier_id(tier);
+    void* addr;
+
+    if (id < 0) {
+        DBG_LOG(ERROR, "pmalloc_tier called with unknown tier %s\n", tier);
+        return NULL;
+    }
+    if (!(addr = numa_alloc_onnode(size, tier_physical_node(id)))) {
+        return NULL;
+    }
+    // misses outside the known regions see the target latency of latency.read
+    if (tier_add_region(addr, size, id) != E_SUCCESS) {
+        DBG_LOG(WARNING, "Too many tier allocations, %p will not see the latency of tier %s\n", addr, tier);
+    }
+    return addr;
+}
+
 void *prealloc(void *old_addr, size_t old_size, size_t new_size)
 {
-    return numa_realloc(old_addr, old_size, new_size);
+    int tier = tier_remove_region(old_addr);
+    void* addr = numa_realloc(old_addr, old_size, new_size);
+
+    if (tier >= 0) {
+        tier_add_region(addr ? addr : old_addr, addr ? new_size : old_size, tier);
+    }
+    return addr;
 }
 
 void pfree(void* start, size_t size)
 {
+    tier_remove_region(start);
     numa_free(start, size);
 }
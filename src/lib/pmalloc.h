@@ -29,6 +29,14 @@ extern "C" {
 #endif
 
 void *pmalloc(size_t size);
+
+/**
+ * \brief Allocate emulated NVRAM of the named tier of latency.tiers.
+ *
+ * The misses to the memory returned see the latencies of the tier. Returns
+ * NULL if there is no such tier. Free it with pfree().
+ */
+void *pmalloc_tier(size_t size, const char *tier);
 void *prealloc(void *old_addr, size_t old_size, size_t new_size);
 void pfree(void *start, size_t size);
 
@@ -0,0 +1,203 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.  
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "error.h"
+#include "debug.h"
+#include "model.h"
+#include "thread.h"
+#include "read_buffer.h"
+
+// MEM_TRANS_RETIRED.LOAD_LATENCY, loads slower than the threshold in config1
+// are sampled by PEBS with their data address and source (Sandy Bridge and 
+// later)
+#define LOAD_LATENCY_EVENT 0x1cd
+#define MIN_LOAD_LATENCY_THRESHOLD 3
+// data pages of the sample ring, a power of two
+#define READ_SAMPLER_PAGES 8
+
+typedef struct read_sampler_s {
+    int fd;
+    struct perf_event_mmap_page* page;
+    char* data;
+    uint64_t data_size;
+} read_sampler_t;
+
+int read_buffer_init(read_buffer_t* buffer, int capacity, int block_bytes)
+{
+    if (capacity <= 0 || capacity > MAX_READ_BUFFER_BLOCKS ||
+            block_bytes <= 0 || (block_bytes & (block_bytes - 1))) {
+        return E_INVAL;
+    }
+
+    memset(buffer, 0, sizeof(read_buffer_t));
+    buffer->capacity = capacity;
+    buffer->block_shift = 63 - __builtin_clzll((uint64_t) block_bytes);
+    return E_SUCCESS;
+}
+
+// Returns whether the media block of addr is in the buffer and makes it the
+// most recently used one, evicting the least recently used on a miss. The
+// threads of a virtual node share its buffer.
+int read_buffer_access(read_buffer_t* buffer, uint64_t addr)
+{
+    uint64_t block = addr >> buffer->block_shift;
+    int i, hit = 0;
+
+    while (__sync_lock_test_and_set(&buffer->lock, 1)) {
+        while (buffer->lock);
+    }
+
+    for (i = 0; i < buffer->num_blocks; i++) {
+        if (buffer->blocks[i] == block) {
+            hit = 1;
+            break;
+        }
+    }
+    if (!hit && buffer->num_blocks < buffer->capacity) {
+        i = buffer->num_blocks++;
+    } else if (!hit) {
+        i = buffer->capacity - 1;
+    }
+    memmove(&buffer->blocks[1], &buffer->blocks[0], i * sizeof(uint64_t));
+    buffer->blocks[0] = block;
+
+    __sync_lock_release(&buffer->lock);
+    return hit;
+}
+
+int read_sampler_open(thread_t* thread)
+{
+    struct perf_event_attr attr;
+    read_sampler_t* sampler;
+    long page_size = sysconf(_SC_PAGESIZE);
+    uint64_t threshold;
+
+    if (!latency_model.read_buffers && !latency_model.num_tiers) {
+        return E_SUCCESS;
+    }
+    if (!(sampler = malloc(sizeof(read_sampler_t)))) {
+        return E_NOMEM;
+    }
+
+    // loads slower than half the DRAM latency missed the LLC
+    threshold = ((uint64_t) thread->cpu_speed_mhz * thread->virtual_node->dram_node->latency) / 2000;
+    if (threshold < MIN_LOAD_LATENCY_THRESHOLD) {
+        threshold = MIN_LOAD_LATENCY_THRESHOLD;
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_RAW;
+    attr.config = LOAD_LATENCY_EVENT;
+    attr.config1 = threshold;
+    attr.sample_period = latency_model.read_sample_period;
+    attr.sample_type = PERF_SAMPLE_ADDR | PERF_SAMPLE_DATA_SRC;
+    attr.precise_ip = 2;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    if ((sampler->fd = (int) syscall(__NR_perf_event_open, &attr, thread->tid, -1, -1, 0)) < 0) {
+        DBG_LOG(WARNING, "thread id [%d] cannot sample its load addresses\n", thread->tid);
+        free(sampler);
+        return E_ERROR;
+    }
+
+    sampler->data_size = (uint64_t) READ_SAMPLER_PAGES * page_size;
+    sampler->page = mmap(NULL, (READ_SAMPLER_PAGES + 1) * page_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, sampler->fd, 0);
+    if (sampler->page == MAP_FAILED) {
+        close(sampler->fd);
+        free(sampler);
+        return E_ERROR;
+    }
+    sampler->data = (char*) sampler->page + page_size;
+
+    thread->read_sampler = sampler;
+    return E_SUCCESS;
+}
+
+static void ring_copy(read_sampler_t* sampler, uint64_t offset, void* dst, size_t len)
+{
+    uint64_t start = offset & (sampler->data_size - 1);
+    size_t first = len < sampler->data_size - start ? len : sampler->data_size - start;
+
+    memcpy(dst, sampler->data + start, first);
+    memcpy((char*) dst + first, sampler->data, len - first);
+}
+
+// Copies up to max_samples misses sampled since the last call and returns
+// how many. Called by the thread itself at the end of an epoch, again as long
+// as it fills the array.
+int read_sampler_drain(thread_t* thread, read_sample_t* samples, int max_samples)
+{
+    read_sampler_t* sampler = thread->read_sampler;
+    struct perf_event_header header;
+    uint64_t head, tail;
+    // the fields of PERF_SAMPLE_ADDR | PERF_SAMPLE_DATA_SRC, in this order
+    struct {
+        uint64_t addr;
+        union perf_mem_data_src data_src;
+    } record;
+    int n = 0;
+
+    if (!sampler) {
+        return 0;
+    }
+
+    head = sampler->page->data_head;
+    __sync_synchronize();
+
+    for (tail = sampler->page->data_tail; tail < head && n < max_samples; tail += header.size) {
+        ring_copy(sampler, tail, &header, sizeof(header));
+        if (header.size == 0) {
+            tail = head;
+            break;
+        }
+        if (header.type != PERF_RECORD_SAMPLE) {
+            continue;
+        }
+        ring_copy(sampler, tail + sizeof(header), &record, sizeof(record));
+        if (record.addr) {
+            samples[n].addr = record.addr;
+            samples[n].local_dram = (record.data_src.mem_lvl & PERF_MEM_LVL_LOC_RAM) != 0;
+            n++;
+        }
+    }
+
+    __sync_synchronize();
+    sampler->page->data_tail = tail;
+    return n;
+}
+
+void read_sampler_close(thread_t* thread)
+{
+    read_sampler_t* sampler = thread->read_sampler;
+
+    if (!sampler) {
+        return;
+    }
+
+    // an epoch closed by a late signal must not drain any more
+    thread->read_sampler = NULL;
+    __asm__ __volatile__ ("" ::: "memory");
+
+    munmap(sampler->page, sampler->data_size + sysconf(_SC_PAGESIZE));
+    close(sampler->fd);
+    free(sampler);
+}
@@ -0,0 +1,57 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.  
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __READ_BUFFER_H
+#define __READ_BUFFER_H
+
+#include <stdint.h>
+
+/**
+ * \file
+ *
+ * On-DIMM read buffer model. NVM modules read whole media blocks and keep the
+ * last ones in a small buffer, so that a miss to a buffered block is served
+ * faster. Each virtual node has an LRU of media blocks fed with the addresses
+ * of the LLC misses its threads sample, and the share of the samples found in
+ * it estimates how many misses of an epoch hit the buffer. The same samples
+ * split the misses among the memory tiers, see tier.h.
+ */
+
+#define MAX_READ_BUFFER_BLOCKS 256
+// one LLC miss out of this many is sampled by default, see latency.read_sample_period
+#define DEFAULT_READ_SAMPLE_PERIOD 1000
+
+typedef struct {
+    volatile int lock;
+    int capacity;
+    int block_shift;
+    int num_blocks;
+    uint64_t blocks[MAX_READ_BUFFER_BLOCKS]; // most recently used first
+} read_buffer_t;
+
+int read_buffer_init(read_buffer_t* buffer, int capacity, int block_bytes);
+int read_buffer_access(read_buffer_t* buffer, uint64_t addr);
+
+// A sampled miss. Samples without a data source are not taken as local.
+typedef struct {
+    uint64_t addr;
+    int local_dram; // served by the DRAM of the sampling processor's node
+} read_sample_t;
+
+struct thread_s;
+
+int read_sampler_open(struct thread_s* thread);
+int read_sampler_drain(struct thread_s* thread, read_sample_t* samples, int max_samples);
+void read_sampler_close(struct thread_s* thread);
+
+#endif /* __READ_BUFFER_H */
@@ -0,0 +1,100 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.  
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include "errno.h"
+#include "registry.h"
+
+int thread_registry_init(thread_registry_t* registry, int capacity)
+{
+    if (!(registry->slots = malloc(capacity * sizeof(thread_slot_t)))) {
+        return E_ERROR;
+    }
+    memset(registry->slots, 0, capacity * sizeof(thread_slot_t));
+    registry->capacity = capacity;
+    registry->next_slot = 0;
+    return E_SUCCESS;
+}
+
+// Returns the slot the thread was published on, or -1 if the registry is full.
+// Each slot is tried at most once so a full registry is detected in capacity steps.
+int thread_registry_add(thread_registry_t* registry, struct thread_s* thread)
+{
+    int i, slot;
+    uint64_t state;
+    thread_slot_t* s;
+
+    slot = __sync_fetch_and_add(&registry->next_slot, 1) % registry->capacity;
+    for (i = 0; i < registry->capacity; i++, slot = (slot + 1) % registry->capacity) {
+        s = &registry->slots[slot];
+        state = s->state;
+        if ((state & SLOT_STATE_MASK) != SLOT_FREE) {
+            continue;
+        }
+        if (!__sync_bool_compare_and_swap(&s->state, state, state | SLOT_CLAIMED)) {
+            continue;
+        }
+        s->thread = thread;
+        // the thread pointer must be visible before the slot is published
+        __sync_synchronize();
+        s->state = state | SLOT_PUBLISHED;
+        return slot;
+    }
+
+    return -1;
+}
+
+void thread_registry_remove(thread_registry_t* registry, int slot)
+{
+    thread_slot_t* s = &registry->slots[slot];
+    uint64_t generation = s->state >> SLOT_STATE_BITS;
+
+    // the slot must not be claimed again before its thread is cleared, and
+    // bumping the generation makes a concurrent scanner drop the thread it read
+    s->thread = NULL;
+    __sync_synchronize();
+    s->state = ((generation + 1) << SLOT_STATE_BITS) | SLOT_FREE;
+}
+
+// Copies the descriptors of up to max_threads published threads, each
+// thread_size bytes, and returns how many were copied. A thread removed while
+// it is copied is dropped, so no copy is of a descriptor already recycled for
+// another thread. Threads added or removed during the scan may or may not be seen.
+int thread_registry_snapshot(thread_registry_t* registry, struct thread_s* threads, size_t thread_size, int max_threads)
+{
+    int i, n = 0;
+    uint64_t state;
+    struct thread_s* thread;
+    thread_slot_t* s;
+
+    for (i = 0; i < registry->capacity && n < max_threads; i++) {
+        s = &registry->slots[i];
+        state = s->state;
+        if ((state & SLOT_STATE_MASK) != SLOT_PUBLISHED) {
+            continue;
+        }
+        __sync_synchronize();
+        thread = s->thread;
+        if (!thread) {
+            continue;
+        }
+        memcpy((char*) threads + n * thread_size, thread, thread_size);
+        __sync_synchronize();
+        if (s->state == state) {
+            n++;
+        }
+    }
+
+    return n;
+}
@@ -0,0 +1,49 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.  
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __REGISTRY_H
+#define __REGISTRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct thread_s;
+
+// low bits of a slot state, the upper bits count how many times the slot was released
+#define SLOT_FREE      0
+#define SLOT_CLAIMED   1
+#define SLOT_PUBLISHED 2
+#define SLOT_STATE_BITS 2
+#define SLOT_STATE_MASK ((1 << SLOT_STATE_BITS) - 1)
+
+typedef struct {
+    volatile uint64_t state; // generation << SLOT_STATE_BITS | SLOT_*
+    struct thread_s* volatile thread;
+} thread_slot_t;
+
+// Fixed-capacity registry of the running threads. Adding and removing a thread
+// take a bounded number of steps and never block, scanners compare the slot
+// state before and after copying the thread to get a consistent view of each
+// slot.
+typedef struct {
+    thread_slot_t* slots;
+    int capacity;
+    volatile unsigned int next_slot; // where the next claim starts looking
+} thread_registry_t;
+
+int thread_registry_init(thread_registry_t* registry, int capacity);
+int thread_registry_add(thread_registry_t* registry, struct thread_s* thread);
+void thread_registry_remove(thread_registry_t* registry, int slot);
+int thread_registry_snapshot(thread_registry_t* registry, struct thread_s* threads, size_t thread_size, int max_threads);
+
+#endif /* __REGISTRY_H */
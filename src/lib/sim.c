@@ -0,0 +1,162 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.  
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <numa.h>
+#include "config.h"
+#include "error.h"
+#include "dev.h"
+#include "misc.h"
+#include "sim.h"
+
+typedef struct {
+    unsigned int bus_id;
+    unsigned int dev_id;
+    unsigned int funct;
+    unsigned int offset;
+    uint16_t val;
+} sim_pci_reg_t;
+
+simulation_t simulation;
+
+static sim_pci_reg_t sim_pci_regs[MAX_SIM_PCI_REGS];
+static int sim_num_pci_regs = 0;
+static const unsigned int sim_mc_pci_functs[SIM_MC_PCI_CHANNELS] = {0x0, 0x1, 0x4, 0x5};
+
+static sim_pci_reg_t* sim_find_pci_reg(unsigned int bus_id, unsigned int device_id, unsigned int function_id, unsigned int offset)
+{
+    int i;
+
+    for (i = 0; i < sim_num_pci_regs; i++) {
+        if (sim_pci_regs[i].bus_id == bus_id && sim_pci_regs[i].dev_id == device_id &&
+                sim_pci_regs[i].funct == function_id && sim_pci_regs[i].offset == offset) {
+            return &sim_pci_regs[i];
+        }
+    }
+    return NULL;
+}
+
+// the sim counters are not programmed through the device
+static int sim_set_counter(unsigned int counter_id, unsigned int event_id)
+{
+    return E_SUCCESS;
+}
+
+static int sim_set_pci(unsigned int bus_id, unsigned int device_id, unsigned int function_id, unsigned int offset, uint16_t val)
+{
+    sim_pci_reg_t* reg;
+
+    if (!(reg = sim_find_pci_reg(bus_id, device_id, function_id, offset))) {
+        if (sim_num_pci_regs == MAX_SIM_PCI_REGS) {
+            return E_NOMEM;
+        }
+        reg = &sim_pci_regs[sim_num_pci_regs++];
+        reg->bus_id = bus_id;
+        reg->dev_id = device_id;
+        reg->funct = function_id;
+        reg->offset = offset;
+    }
+    reg->val = val;
+    return E_SUCCESS;
+}
+
+static int sim_get_pci(unsigned int bus_id, unsigned int device_id, unsigned int function_id, unsigned int offset, uint16_t* val)
+{
+    sim_pci_reg_t* reg;
+
+    reg = sim_find_pci_reg(bus_id, device_id, function_id, offset);
+    *val = reg ? reg->val : SIM_PCI_RESET_VAL;
+    return E_SUCCESS;
+}
+
+// one bus per NUMA node, in node order
+static int sim_mc_pci_bus_list(pci_regs_t* bus_id_list[], int max_list_size, int* dev_countp)
+{
+    int node, channel;
+    int dev_count = numa_max_node() + 1;
+
+    if (dev_count > max_list_size) {
+        return E_ERROR;
+    }
+    for (node = 0; node < dev_count; node++) {
+        if (!(bus_id_list[node] = (pci_regs_t*) malloc(sizeof(pci_regs_t)))) {
+            while (node-- > 0) {
+                free(bus_id_list[node]);
+                bus_id_list[node] = NULL;
+            }
+            return E_NOMEM;
+        }
+        for (channel = 0; channel < SIM_MC_PCI_CHANNELS; channel++) {
+            bus_id_list[node]->addr[channel].bus_id = SIM_MC_PCI_BUS(node);
+            bus_id_list[node]->addr[channel].dev_id = SIM_MC_PCI_DEV;
+            bus_id_list[node]->addr[channel].funct = sim_mc_pci_functs[channel];
+        }
+        bus_id_list[node]->channels = SIM_MC_PCI_CHANNELS;
+    }
+    *dev_countp = dev_count;
+    return E_SUCCESS;
+}
+
+// The memory of mem_node delivers what the throttle level of the first
+// channel of its bus allows, wherever it is read from
+static int sim_read_bw(int cpu_node, int mem_node, double* bw)
+{
+    uint16_t val;
+
+    sim_get_pci(SIM_MC_PCI_BUS(mem_node), SIM_MC_PCI_DEV, sim_mc_pci_functs[0], SIM_THROTTLE_DDR_ACT_OFFSET, &val);
+    *bw = (double) interpolate_curve(simulation.bw_level, simulation.bw_mbps, simulation.bw_points, val & 0xfff);
+    DBG_LOG(DEBUG, "simulated read BW on cpu node %d and mem node %d: %f\n", cpu_node, mem_node, *bw);
+    return E_SUCCESS;
+}
+
+dev_backend_t dev_sim_backend = {
+    .name = "sim",
+    .set_counter = sim_set_counter,
+    .set_pci = sim_set_pci,
+    .get_pci = sim_get_pci,
+    .mc_pci_bus_list = sim_mc_pci_bus_list,
+    .read_bw = sim_read_bw
+};
+
+int init_simulation(config_t* cfg)
+{
+    char* str;
+
+    __cconfig_lookup_bool(cfg, "simulation.enable", &simulation.enabled);
+    if (!simulation.enabled) {
+        return E_SUCCESS;
+    }
+
+    str = DEFAULT_SIM_CPU;
+    __cconfig_lookup_string(cfg, "simulation.cpu", &str);
+    simulation.cpu = strdup(str);
+    if (__cconfig_lookup_string(cfg, "simulation.pmc_script", &str) == CONFIG_TRUE) {
+        simulation.pmc_script = strdup(str);
+    }
+    if (__cconfig_lookup_string(cfg, "simulation.pmc_rates", &str) == CONFIG_TRUE) {
+        simulation.pmc_rates = strdup(str);
+    }
+
+    str = DEFAULT_SIM_BANDWIDTH_CURVE;
+    __cconfig_lookup_string(cfg, "simulation.bandwidth_curve", &str);
+    if (parse_curve(str, simulation.bw_level, simulation.bw_mbps,
+                    MAX_SIM_BW_POINTS, &simulation.bw_points) != E_SUCCESS) {
+        DBG_LOG(ERROR, "Invalid simulation.bandwidth_curve \"%s\"\n", str);
+        return E_INVAL;
+    }
+
+    dev_set_backend(&dev_sim_backend);
+    DBG_LOG(INFO, "Simulating a %s processor, %d bandwidth curve points\n", simulation.cpu, simulation.bw_points);
+    return E_SUCCESS;
+}
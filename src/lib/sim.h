@@ -0,0 +1,62 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.  
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __SIM_H
+#define __SIM_H
+
+#include "config.h"
+
+/**
+ * \file
+ *
+ * Simulated hardware, for running the emulator on machines without the
+ * kernel module, the performance counters or the memory controller throttle
+ * registers (simulation.enable). A simulated device keeps the pci registers
+ * in memory and reports the read bandwidth of a node from the throttle
+ * level written to its bus, and the sim performance counter backend (see
+ * cpu/pmc-sim.c) replays scripted counts or counts at fixed rates. The
+ * latency and bandwidth models, the topology discovery and the epochs then
+ * run unchanged and deterministically.
+ */
+
+#define MAX_SIM_BW_POINTS 32
+#define MAX_SIM_PCI_REGS 256
+// memory-controller pci bus of each simulated node, with the channels of
+// the Xeon E5 memory controllers
+#define SIM_MC_PCI_BUS(node) (0x80 + (node))
+#define SIM_MC_PCI_DEV 0x10
+#define SIM_MC_PCI_CHANNELS 4
+// registers never written read as the unthrottled value
+#define SIM_PCI_RESET_VAL 0x8fff
+#define SIM_THROTTLE_DDR_ACT_OFFSET 0x190
+
+#define DEFAULT_SIM_CPU "Ivy Bridge Xeon"
+// throttle level (low 12 bits of the register):MB/s, saturating from 1200
+#define DEFAULT_SIM_BANDWIDTH_CURVE "15:400,1200:10000"
+#define SIM_PMC_BACKEND "sim"
+
+typedef struct {
+    int enabled;
+    char* cpu; // microarch name, see microarch_strings
+    char* pmc_script; // file of counts replayed by the sim counters
+    char* pmc_rates; // counts per 1000 TSC cycles when there is no script
+    int bw_level[MAX_SIM_BW_POINTS];
+    int bw_mbps[MAX_SIM_BW_POINTS];
+    int bw_points;
+} simulation_t;
+
+extern simulation_t simulation;
+
+int init_simulation(config_t* cfg);
+
+#endif /* __SIM_H */
@@ -12,17 +12,19 @@ with this program; if not, write to the Free Software Foundation,
 Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 ***************************************************************************/
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-#include "utlist.h"
 #include "stat.h"
 #include "thread.h"
+#include "thread_pool.h"
 #include "interpose.h"
 #include "model.h"
+#include "monotonic_timer.h"
 
-thread_manager_t* get_thread_manager();
 hrtime_t cycles_to_us(int cpu_speed_mhz, hrtime_t cycles);
 
 #ifdef USE_STATISTICS
@@ -49,7 +51,7 @@ static char *get_current_time() {
     time_t curtime;
     char *str_time;
 
-    time(&curtime);
+    __lib_time(&curtime);
     str_time = ctime(&curtime);
     str_time[strlen(str_time) - 1] = 0;
 
@@ -64,9 +66,161 @@ static inline hrtime_t ns_to_cycles(int cpu_speed_mhz, int ns)
 extern __thread int tls_hw_local_latency;
 extern __thread int tls_hw_remote_latency;
 
-static void show_thread_stats(thread_t *thread, FILE *out_file) {
+// upper bound of the bucket the given fraction (per thousand) of the values falls in
+static uint64_t histogram_percentile(uint64_t *histogram, uint64_t count, int per_mille) {
+    uint64_t seen = 0;
+    uint64_t rank = (count * per_mille + 999) / 1000;
+    int i;
+
+    for (i = 0; i < DELAY_HISTOGRAM_BUCKETS; i++) {
+        seen += histogram[i];
+        if (seen >= rank && seen > 0) {
+            return 1ULL << i;
+        }
+    }
+    return 1ULL << (DELAY_HISTOGRAM_BUCKETS - 1);
+}
+
+static void show_delay_distribution(uint64_t *histogram, FILE *out_file) {
+    uint64_t count = 0;
+    int i;
+
+    for (i = 0; i < DELAY_HISTOGRAM_BUCKETS; i++) {
+        count += histogram[i];
+    }
+    if (count == 0) return;
+
+    fprintf(out_file, "\t\t: epoch delay p50/p90/p99/p99.9 below: %lu/%lu/%lu/%lu usec\n",
+            histogram_percentile(histogram, count, 500), histogram_percentile(histogram, count, 900),
+            histogram_percentile(histogram, count, 990), histogram_percentile(histogram, count, 999));
+    if (!latency_model.distributions) return;
+    for (i = 0; i < DELAY_HISTOGRAM_BUCKETS; i++) {
+        if (histogram[i]) {
+            fprintf(out_file, "\t\t: epochs with delay below %lu usec: %lu\n", 1UL << i, histogram[i]);
+        }
+    }
+}
+
+static void show_signal_delivery(thread_stats_t *stats, uint64_t tsc, FILE *out_file) {
+    uint64_t *histogram = stats->signal_delivery_histogram;
+    uint64_t count = stats->signals_received;
+
+    if (count == 0) return;
+
+    fprintf(out_file, "\t\t: average signal delivery latency: %lu nsec\n",
+            (stats->signal_delivery_cycles * NANOS_PER_USEC) / (count * tsc));
+    fprintf(out_file, "\t\t: signal delivery p50/p90/p99 below: %lu/%lu/%lu nsec\n",
+            histogram_percentile(histogram, count, 500), histogram_percentile(histogram, count, 900),
+            histogram_percentile(histogram, count, 990));
+}
+
+static void show_epoch_stats(thread_stats_t *stats, int cpu_speed_mhz, virtual_node_t *virtual_node, FILE *out_file) {
     uint64_t fixed_value;
     uint64_t cycles;
+    int i;
+    uint64_t tsc = tsc_mhz() > 0 ? tsc_mhz() : 1; // epoch durations are kept in TSC cycles
+
+    fprintf(out_file, "\t\t: stall cycles: %lu\n", stats->stall_cycles);
+
+    if (virtual_node->dram_node != virtual_node->nvram_node &&
+                latency_model.pmc_remote_dram) {
+        cycles = ns_to_cycles(cpu_speed_mhz, tls_hw_remote_latency);
+        fixed_value = cycles ? stats->stall_cycles / cycles : 0;
+    }
+    else {
+        cycles = ns_to_cycles(cpu_speed_mhz, tls_hw_local_latency);
+        fixed_value = cycles ? stats->stall_cycles / cycles : 0;
+    }
+    fprintf(out_file, "\t\t: NVM accesses: %lu\n", fixed_value);
+    if (latency_model.pmc_dram_writebacks) {
+        fprintf(out_file, "\t\t: NVM writebacks: %lu\n", stats->dram_writebacks);
+    }
+
+
+    fprintf(out_file, "\t\t: latency calculation overhead cycles: %lu\n", stats->overhead_cycles);
+    fprintf(out_file, "\t\t: injected delay cycles: %lu\n", stats->delay_cycles);
+    if (latency_model.pmc_dram_writebacks) {
+        fprintf(out_file, "\t\t: injected write delay cycles: %lu\n", stats->write_delay_cycles);
+    }
+    if (latency_model.media_block_bytes && stats->flushed_lines) {
+        // flushes combined with a buffered block
+        fixed_value = stats->media_block_writes < stats->flushed_lines ?
+                (stats->flushed_lines - stats->media_block_writes) * 10000 / stats->flushed_lines : 0;
+        fprintf(out_file, "\t\t: write buffer hit rate: %lu.%02lu%%\n", fixed_value / 100, fixed_value % 100);
+    }
+    if (latency_model.media_block_bytes && (stats->flushed_lines || stats->nt_store_lines)) {
+        // media bytes written per byte flushed or stored
+        fixed_value = (stats->media_block_writes + stats->nt_media_block_writes) * latency_model.media_block_bytes * 100 /
+                ((stats->flushed_lines + stats->nt_store_lines) * CACHE_LINE_BYTES);
+        fprintf(out_file, "\t\t: write amplification: %lu.%02lu\n", fixed_value / 100, fixed_value % 100);
+    }
+    if (latency_model.read_buffers && stats->read_samples) {
+        fixed_value = stats->read_buffer_hits * 10000 / stats->read_samples;
+        fprintf(out_file, "\t\t: read buffer hit rate: %lu.%02lu%% of %lu sampled misses\n",
+                fixed_value / 100, fixed_value % 100, stats->read_samples);
+    }
+    for (i = 0; i < latency_model.num_tiers && stats->read_samples; i++) {
+        fixed_value = stats->tier_misses[i] * 10000 / stats->read_samples;
+        fprintf(out_file, "\t\t: tier %s sampled misses: %lu (%lu.%02lu%%)\n", latency_model.tiers[i].name,
+                stats->tier_misses[i], fixed_value / 100, fixed_value % 100);
+    }
+    if (latency_model.pmc_memory_parallelism && stats->epochs) {
+        fixed_value = (stats->memory_parallelism * 100 / stats->epochs) >> MLP_SHIFT;
+        fprintf(out_file, "\t\t: average memory level parallelism: %lu.%02lu\n", fixed_value / 100, fixed_value % 100);
+    }
+    if (cpu_speed_mhz) {
+        fprintf(out_file, "\t\t: injected delay in usec: %lu\n", cycles_to_us(cpu_speed_mhz, stats->delay_cycles));
+    }
+    show_delay_distribution(stats->delay_histogram, out_file);
+    fprintf(out_file, "\t\t: longest epoch duration: %lu usec\n", stats->longest_epoch_duration_cycles / tsc);
+    fixed_value = (stats->shortest_epoch_duration_cycles == UINT64_MAX) ? 0 : stats->shortest_epoch_duration_cycles;
+    fprintf(out_file, "\t\t: shortest epoch duration: %lu usec\n", fixed_value / tsc);
+    fixed_value = stats->epochs ? (stats->overall_epoch_duration_cycles / stats->epochs) :
+    		stats->overall_epoch_duration_cycles;
+    fprintf(out_file, "\t\t: average epoch duration: %lu usec\n", fixed_value / tsc);
+    fprintf(out_file, "\t\t: number of epochs: %lu\n", stats->epochs);
+    fprintf(out_file, "\t\t: epochs which didn't reach min duration: %lu\n", stats->min_epoch_not_reached);
+    fprintf(out_file, "\t\t: static epochs requested: %lu\n", stats->signals_sent);
+    show_signal_delivery(stats, tsc, out_file);
+}
+
+// Execution time the thread would have taken at the i-th latency.sweep target:
+// the delay requested at the emulated latency is swapped for the target's.
+// In virtual time mode the delay was added to the clocks of the thread rather
+// than spent, so the projection starts from its virtual execution time.
+static uint64_t projected_time_us(thread_stats_t *stats, uint64_t execution_time_us, int i, int cpu_speed_mhz) {
+    uint64_t requested_us, sweep_us;
+
+    execution_time_us += stats->virtual_time_offset_us;
+    if (!cpu_speed_mhz) return execution_time_us;
+
+    requested_us = cycles_to_us(cpu_speed_mhz, stats->requested_delay_cycles);
+    sweep_us = cycles_to_us(cpu_speed_mhz, stats->sweep_delay_cycles[i]);
+    if (execution_time_us + sweep_us < requested_us) return 0;
+    return execution_time_us + sweep_us - requested_us;
+}
+
+// label tells what execution_time_us is, one thread or the sum of several
+static void show_sweep_stats(thread_stats_t *stats, uint64_t execution_time_us, int cpu_speed_mhz,
+                             const char *label, FILE *out_file) {
+    int i;
+
+    for (i = 0; i < latency_model.sweep_points; i++) {
+        fprintf(out_file, "\t\t: projected %s at %d ns: %lu usecs\n", label, latency_model.sweep_latency_ns[i],
+                projected_time_us(stats, execution_time_us, i, cpu_speed_mhz));
+    }
+}
+
+// running threads have no termination timestamp yet
+static uint64_t thread_execution_time_us(thread_t *thread) {
+    if (thread->stats.unregister_timestamp > 0) {
+        return thread->stats.unregister_timestamp - thread->stats.register_timestamp;
+    }
+    return (uint64_t) monotonic_time_us() - thread->stats.register_timestamp;
+}
+
+static void show_thread_stats(thread_t *thread, FILE *out_file) {
+    uint64_t fixed_value;
 
     fprintf(out_file, "\tThread id [%d]\n", thread->tid);
     fprintf(out_file, "\t\t: cpu id: %d\n", thread->cpu_id);
@@ -74,38 +228,90 @@ static void show_thread_stats(thread_t *thread, FILE *out_file) {
     fprintf(out_file, "\t\t: termination timestamp: %lu\n", thread->stats.unregister_timestamp);
     fixed_value = thread->stats.unregister_timestamp > 0 ? (thread->stats.unregister_timestamp - thread->stats.register_timestamp) : 0;
     fprintf(out_file, "\t\t: execution time: %lu usecs\n", fixed_value);
-    fprintf(out_file, "\t\t: stall cycles: %lu\n", thread->stats.stall_cycles);
+    show_epoch_stats(&thread->stats, thread->cpu_speed_mhz, thread->virtual_node, out_file);
+    show_sweep_stats(&thread->stats, thread_execution_time_us(thread), thread->cpu_speed_mhz, "execution time", out_file);
+    if (thread->thread_manager->adaptive_epochs) {
+        uint64_t tsc = tsc_mhz() > 0 ? tsc_mhz() : 1;
 
-    if (thread->virtual_node->dram_node != thread->virtual_node->nvram_node &&
-                latency_model.pmc_remote_dram) {
-        cycles = ns_to_cycles(thread->cpu_speed_mhz, tls_hw_remote_latency);
-        fixed_value = cycles ? thread->stats.stall_cycles / cycles : 0;
+        fprintf(out_file, "\t\t: adapted min epoch duration: %lu usec\n", thread->min_epoch_cycles / tsc);
+        fprintf(out_file, "\t\t: adapted max epoch duration: %lu usec\n", thread->max_epoch_cycles / tsc);
     }
-    else {
-        cycles = ns_to_cycles(thread->cpu_speed_mhz, tls_hw_local_latency);
-        fixed_value = cycles ? thread->stats.stall_cycles / cycles : 0;
-    }
-    fprintf(out_file, "\t\t: NVM accesses: %lu\n", fixed_value);
+}
 
+static void show_summary_stats(thread_stats_summary_t *summary, virtual_node_t *virtual_node, FILE *out_file) {
+    fprintf(out_file, "\tVirtual node [%d]\n", virtual_node->node_id);
+    fprintf(out_file, "\t\t: threads: %lu\n", summary->threads);
+    fprintf(out_file, "\t\t: execution time: %lu usecs\n", summary->execution_time_us);
+    show_epoch_stats(&summary->stats, cpu_speed_mhz(), virtual_node, out_file);
+    show_sweep_stats(&summary->stats, summary->execution_time_us, cpu_speed_mhz(), "summed thread time", out_file);
+}
+
+void stats_init_summary(thread_stats_summary_t* summary) {
+    memset(summary, 0, sizeof(thread_stats_summary_t));
+    summary->stats.shortest_epoch_duration_cycles = UINT64_MAX;
+}
+
+static void fold_min(volatile uint64_t *dst, uint64_t value) {
+    uint64_t cur;
+
+    while ((cur = *dst) > value && !__sync_bool_compare_and_swap(dst, cur, value));
+}
+
+static void fold_max(volatile uint64_t *dst, uint64_t value) {
+    uint64_t cur;
+
+    while ((cur = *dst) < value && !__sync_bool_compare_and_swap(dst, cur, value));
+}
 
-    fprintf(out_file, "\t\t: latency calculation overhead cycles: %lu\n", thread->stats.overhead_cycles);
-    fprintf(out_file, "\t\t: injected delay cycles: %lu\n", thread->stats.delay_cycles);
-    if (thread->cpu_speed_mhz) {
-        fprintf(out_file, "\t\t: injected delay in usec: %lu\n", cycles_to_us(thread->cpu_speed_mhz, thread->stats.delay_cycles));
+// called by terminating threads, possibly several of the same virtual node at once
+void stats_fold_thread_stats(thread_stats_summary_t* summary, thread_stats_t* stats) {
+    thread_stats_t *dst = &summary->stats;
+    uint64_t execution_time_us = stats->unregister_timestamp - stats->register_timestamp;
+    int i;
+
+    __sync_fetch_and_add(&summary->threads, 1);
+    __sync_fetch_and_add(&summary->execution_time_us, execution_time_us);
+    __sync_fetch_and_add(&dst->stall_cycles, stats->stall_cycles);
+    __sync_fetch_and_add(&dst->overhead_cycles, stats->overhead_cycles);
+    __sync_fetch_and_add(&dst->delay_cycles, stats->delay_cycles);
+    __sync_fetch_and_add(&dst->requested_delay_cycles, stats->requested_delay_cycles);
+    __sync_fetch_and_add(&dst->virtual_time_offset_us, stats->virtual_time_offset_us);
+    for (i = 0; i < latency_model.sweep_points; i++) {
+        __sync_fetch_and_add(&dst->sweep_delay_cycles[i], stats->sweep_delay_cycles[i]);
+        fold_max(&summary->longest_projected_time_us[i],
+                 projected_time_us(stats, execution_time_us, i, cpu_speed_mhz()));
+    }
+    __sync_fetch_and_add(&dst->dram_writebacks, stats->dram_writebacks);
+    __sync_fetch_and_add(&dst->write_delay_cycles, stats->write_delay_cycles);
+    __sync_fetch_and_add(&dst->flushed_lines, stats->flushed_lines);
+    __sync_fetch_and_add(&dst->media_block_writes, stats->media_block_writes);
+    __sync_fetch_and_add(&dst->nt_store_lines, stats->nt_store_lines);
+    __sync_fetch_and_add(&dst->nt_media_block_writes, stats->nt_media_block_writes);
+    __sync_fetch_and_add(&dst->read_samples, stats->read_samples);
+    __sync_fetch_and_add(&dst->read_buffer_hits, stats->read_buffer_hits);
+    for (i = 0; i < MAX_TIERS; i++) {
+        __sync_fetch_and_add(&dst->tier_misses[i], stats->tier_misses[i]);
     }
-    fprintf(out_file, "\t\t: longest epoch duration: %lu usec\n", thread->stats.longest_epoch_duration_us);
-    fixed_value = (thread->stats.shortest_epoch_duration_us == UINT64_MAX) ? 0 : thread->stats.shortest_epoch_duration_us;
-    fprintf(out_file, "\t\t: shortest epoch duration: %lu usec\n", fixed_value);
-    fixed_value = thread->stats.epochs ? (thread->stats.overall_epoch_duration_us / thread->stats.epochs) :
-    		thread->stats.overall_epoch_duration_us;
-    fprintf(out_file, "\t\t: average epoch duration: %lu usec\n", fixed_value);
-    fprintf(out_file, "\t\t: number of epochs: %lu\n", thread->stats.epochs);
-    fprintf(out_file, "\t\t: epochs which didn't reach min duration: %lu\n", thread->stats.min_epoch_not_reached);
-    fprintf(out_file, "\t\t: static epochs requested: %lu\n", thread->stats.signals_sent);
+    __sync_fetch_and_add(&dst->memory_parallelism, stats->memory_parallelism);
+    for (i = 0; i < DELAY_HISTOGRAM_BUCKETS; i++) {
+        __sync_fetch_and_add(&dst->delay_histogram[i], stats->delay_histogram[i]);
+        __sync_fetch_and_add(&dst->signal_delivery_histogram[i], stats->signal_delivery_histogram[i]);
+    }
+    __sync_fetch_and_add(&dst->signals_sent, stats->signals_sent);
+    __sync_fetch_and_add(&dst->signals_received, stats->signals_received);
+    __sync_fetch_and_add(&dst->signal_delivery_cycles, stats->signal_delivery_cycles);
+    __sync_fetch_and_add(&dst->epochs, stats->epochs);
+    __sync_fetch_and_add(&dst->overall_epoch_duration_cycles, stats->overall_epoch_duration_cycles);
+    __sync_fetch_and_add(&dst->min_epoch_not_reached, stats->min_epoch_not_reached);
+    fold_min(&dst->shortest_epoch_duration_cycles, stats->shortest_epoch_duration_cycles);
+    fold_max(&dst->longest_epoch_duration_cycles, stats->longest_epoch_duration_cycles);
 }
 
 void stats_report() {
-    thread_t *thread;
+    thread_t *running;
+    int i, j;
+    uint64_t longest_projected_time_us[MAX_SWEEP_LATENCIES];
+    uint64_t projected_us;
     FILE *out_file;
     uint64_t running_threads = 0;
     thread_manager_t* thread_manager = get_thread_manager();
@@ -124,11 +330,17 @@ void stats_report() {
         out_file = stdout;
     }
 
-    __lib_pthread_mutex_lock(&thread_manager->mutex);
-    LL_FOREACH(thread_manager->thread_list, thread) {
-        running_threads++;
+    // the report must not block threads that register or terminate meanwhile,
+    // it works on copies of their descriptors which may be recycled any time
+    if (!(running = malloc(thread_manager->max_threads * sizeof(thread_t)))) {
+        if (out_file != stdout) {
+            fclose(out_file);
+        }
+        return;
     }
-    __lib_pthread_mutex_unlock(&thread_manager->mutex);
+    running_threads = thread_registry_snapshot(&thread_manager->registry, running, sizeof(thread_t),
+                                               thread_manager->max_threads);
+    memset(longest_projected_time_us, 0, sizeof(longest_projected_time_us));
 
     fprintf(out_file, "\n\n===== STATISTICS (%s) =====\n\n", get_current_time());
     if (!latency_model.inject_delay) {
@@ -143,19 +355,43 @@ void stats_report() {
 
     fprintf(out_file, "== Running threads == \n");
 
-    __lib_pthread_mutex_lock(&thread_manager->mutex);
-    LL_FOREACH(thread_manager->thread_list, thread) {
-    	show_thread_stats(thread, out_file);
+    for (i = 0; i < running_threads; i++) {
+    	// running threads only record their virtual time offset when they terminate
+    	running[i].stats.virtual_time_offset_us = running[i].virtual_time_offset / thread_manager->tsc_mhz;
+    	show_thread_stats(&running[i], out_file);
+    	for (j = 0; j < latency_model.sweep_points; j++) {
+    	    projected_us = projected_time_us(&running[i].stats, thread_execution_time_us(&running[i]), j,
+    	                                           running[i].cpu_speed_mhz);
+    	    if (projected_us > longest_projected_time_us[j]) {
+    	        longest_projected_time_us[j] = projected_us;
+    	    }
+    	}
     }
-    __lib_pthread_mutex_unlock(&thread_manager->mutex);
+    free(running);
 
     fprintf(out_file, "\n== Terminated threads == \n");
 
-    __lib_pthread_mutex_lock(&thread_manager->mutex);
-    LL_FOREACH(thread_manager->stats.thread_list, thread) {
-    	show_thread_stats(thread, out_file);
+    for (i = 0; i < thread_manager->virtual_topology->num_virtual_nodes; i++) {
+        if (thread_manager->thread_pools[i].terminated.threads > 0) {
+            show_summary_stats(&thread_manager->thread_pools[i].terminated,
+                               &thread_manager->virtual_topology->virtual_nodes[i], out_file);
+            for (j = 0; j < latency_model.sweep_points; j++) {
+                if (thread_manager->thread_pools[i].terminated.longest_projected_time_us[j] > longest_projected_time_us[j]) {
+                    longest_projected_time_us[j] = thread_manager->thread_pools[i].terminated.longest_projected_time_us[j];
+                }
+            }
+        }
+    }
+
+    // the longest thread bounds the runtime of the whole process
+    if (latency_model.sweep_points) {
+        fprintf(out_file, "\n== Latency sweep == \n");
+        fprintf(out_file, "\t(longest thread, constant read delay ratio model only)\n");
+        for (j = 0; j < latency_model.sweep_points; j++) {
+            fprintf(out_file, "\tprojected longest thread time at %d ns: %lu usecs\n", latency_model.sweep_latency_ns[j],
+                    longest_projected_time_us[j]);
+        }
     }
-    __lib_pthread_mutex_unlock(&thread_manager->mutex);
 
     if (out_file != stdout) {
         fclose(out_file);
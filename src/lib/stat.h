@@ -18,12 +18,21 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include <stdint.h>
 #include "config.h"
 
+// target read latencies whose runtime is projected at once, see latency.sweep
+#define MAX_SWEEP_LATENCIES 8
+
+// memory tiers of latency.tiers
+#define MAX_TIERS 8
+
+// per-epoch injected delays, bucket i holds delays below 2^i usec. Also used
+// for signal delivery latencies in nsec.
+#define DELAY_HISTOGRAM_BUCKETS 32
+
 #ifdef USE_STATISTICS
 struct thread_s;
 
 typedef struct {
     int enabled;
-    struct thread_s* thread_list;
     uint64_t n_threads;
     uint64_t init_time_us;
     char *output_file;
@@ -33,20 +42,54 @@ typedef struct {
     uint64_t stall_cycles;
     uint64_t overhead_cycles;
     uint64_t delay_cycles;
+    uint64_t requested_delay_cycles; // delay before the overhead discount, 0 when not injected
+    uint64_t sweep_delay_cycles[MAX_SWEEP_LATENCIES]; // delay each latency.sweep target would have requested
+    uint64_t dram_writebacks;
+    uint64_t write_delay_cycles;
+    uint64_t flushed_lines; // by pflush()
+    uint64_t media_block_writes; // writes those lines cost the media
+    uint64_t nt_store_lines; // declared by pflush_nt_stores(), they never hit the write buffer
+    uint64_t nt_media_block_writes;
+    uint64_t read_samples; // sampled LLC miss addresses
+    uint64_t read_buffer_hits; // samples whose media block was in the read buffer
+    uint64_t tier_misses[MAX_TIERS]; // samples in the regions of each tier
+    uint64_t memory_parallelism; // sum over the epochs, MLP_SHIFT fractional bits
+    uint64_t delay_histogram[DELAY_HISTOGRAM_BUCKETS];
     uint64_t signals_sent;
+    uint64_t signals_received;
+    uint64_t signal_delivery_cycles; // TSC cycles, charged to the overhead
+    uint64_t signal_delivery_histogram[DELAY_HISTOGRAM_BUCKETS]; // bucket i holds latencies below 2^i nsec
     uint64_t epochs;
-    double last_epoch_timestamp;
-    uint64_t shortest_epoch_duration_us;
-    uint64_t longest_epoch_duration_us;
-    uint64_t overall_epoch_duration_us;
+    uint64_t shortest_epoch_duration_cycles;
+    uint64_t longest_epoch_duration_cycles;
+    uint64_t overall_epoch_duration_cycles;
     uint64_t min_epoch_not_reached;
     uint64_t register_timestamp;
     uint64_t unregister_timestamp;
+    uint64_t virtual_time_offset_us; // clocks ahead of real time, set at termination, see latency.virtual_time
 } thread_stats_t;
 
+// statistics of the terminated threads of a virtual node, folded together so
+// that thread descriptors can be recycled
+typedef struct {
+    uint64_t threads;
+    uint64_t execution_time_us;
+    uint64_t longest_projected_time_us[MAX_SWEEP_LATENCIES]; // longest thread at each latency.sweep target
+    thread_stats_t stats;
+} thread_stats_summary_t;
+
 void stats_enable(config_t *cfg);
 void stats_set_init_time(double init_time_us);
 void stats_report();
+void stats_init_summary(thread_stats_summary_t* summary);
+void stats_fold_thread_stats(thread_stats_summary_t* summary, thread_stats_t* stats);
+
+static inline void stats_histogram_add(uint64_t* histogram, uint64_t value)
+{
+    int bucket = value ? 64 - __builtin_clzll(value) : 0;
+
+    histogram[bucket < DELAY_HISTOGRAM_BUCKETS ? bucket : DELAY_HISTOGRAM_BUCKETS - 1]++;
+}
 #endif
 
 double sum(double array[], int n);
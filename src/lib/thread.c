@@ -11,23 +11,39 @@ should have received a copy of the GNU General Public License along
 with this program; if not, write to the Free Software Foundation,
 Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 ***************************************************************************/
+#define _GNU_SOURCE
 #include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <time.h>
+#include <cpuid.h>
+#include <string.h>
 #include "cpu/cpu.h"
-#include "utlist.h"
 #include "error.h"
 #include "interpose.h"
+#include "epoch_log.h"
+#include "read_buffer.h"
 #include "model.h"
 #include "thread.h"
+#include "thread_pool.h"
 #include "topology.h"
 #include "monotonic_timer.h"
 
+// glibc exposes the target thread of SIGEV_THREAD_ID through this name only since 2.35
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
 static thread_manager_t* thread_manager = NULL;
 __thread thread_t* tls_thread = NULL;
 
+extern __thread uint64_t tls_overhead;
+
 extern inline hrtime_t hrtime_cycles(void);
 
 // assign a virtual/physical node using a round-robin policy
@@ -54,6 +70,33 @@ static void rr_next_cpu_id(thread_manager_t* thread_manager, int* next_virtual_n
     } 
 }
 
+// Lays out the rest of the round-robin sequence so that registering threads
+// only take a ticket. Called whenever the policy state changes, which only
+// happens during initialization.
+static int build_cpu_ring(thread_manager_t* thread_manager)
+{
+    int i;
+    int max_size = numa_num_configured_cpus() + 1;
+    cpu_assignment_t* ring;
+
+    if (!(ring = malloc(max_size * sizeof(cpu_assignment_t)))) {
+        return E_ERROR;
+    }
+    rr_next_cpu_id(thread_manager, &ring[0].virtual_node_id, &ring[0].cpu_id);
+    for (i = 1; i < max_size; i++) {
+        rr_next_cpu_id(thread_manager, &ring[i].virtual_node_id, &ring[i].cpu_id);
+        if (ring[i].virtual_node_id == ring[0].virtual_node_id && ring[i].cpu_id == ring[0].cpu_id) {
+            break;
+        }
+    }
+
+    free(thread_manager->cpu_ring);
+    thread_manager->cpu_ring = ring;
+    thread_manager->cpu_ring_size = i;
+    thread_manager->next_cpu_ticket = 0;
+    return E_SUCCESS;
+}
+
 void rr_set_next_cpu_based_on_rank(int rank, int max_rank)
 {
     int cpu_id;
@@ -69,6 +112,7 @@ void rr_set_next_cpu_based_on_rank(int rank, int max_rank)
 
     DBG_LOG(DEBUG, "no partitioning of CPUs, set next CPU "
                    "to vnode %d and cpu %d\n", virtual_node_id, cpu_id);
+    build_cpu_ring(thread_manager);
 }
 
 void partition_cpus_based_on_rank(int rank, int max_rank, int num_cpus,
@@ -105,6 +149,7 @@ void partition_cpus_based_on_rank(int rank, int max_rank, int num_cpus,
             }
         }
     }
+    build_cpu_ring(thread_manager);
 }
 
 int bind_thread_on_cpu(thread_manager_t* thread_manager, thread_t* thread, int virtual_node_id, int cpu_id)
@@ -139,49 +184,265 @@ thread_t* thread_self()
     return tls_thread;
 }
 
+// one-shot, timer_settime is async-signal-safe so it is re-armed from the handler
+static void arm_epoch_timer(thread_t* thread, hrtime_t cycles)
+{
+    struct itimerspec its;
+    uint64_t ns = (cycles * NANOS_PER_USEC) / thread_manager->tsc_mhz;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = ns / (USECS_PER_SEC * NANOS_PER_USEC);
+    its.it_value.tv_nsec = ns % (USECS_PER_SEC * NANOS_PER_USEC);
+    if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+        // a zero value would disarm the timer
+        its.it_value.tv_nsec = 1;
+    }
+    timer_settime(thread->epoch_timer, 0, &its, NULL);
+}
+
+// Charges the cost of the signal being handled to the overhead of the thread.
+// Signals of the monitor carry the time they were sent at. Timer expiries and
+// counter overflows do not, and the timer slack lets the thread run on past 
+// an expiry, so they cost the delivery measured at startup.
+static void account_signal_delivery(thread_t* thread, hrtime_t now)
+{
+    hrtime_t sent = thread->signal_timestamp;
+    hrtime_t delivery_cycles;
+
+    thread->signal_timestamp = 0;
+    delivery_cycles = (sent && now > sent) ? now - sent : thread_manager->signal_delivery_cycles;
+    tls_overhead += delivery_cycles + thread_manager->signal_return_cycles;
+
+#ifdef USE_STATISTICS
+    if (thread_manager->stats.enabled) {
+        thread->stats.signal_delivery_cycles += delivery_cycles;
+        thread->stats.signals_received++;
+        stats_histogram_add(thread->stats.signal_delivery_histogram,
+                            (delivery_cycles * NANOS_PER_USEC) / thread_manager->tsc_mhz);
+    }
+#endif
+}
+
+// the counter is enabled until its next overflow, ioctl() is async-signal-safe
+static void arm_epoch_counter(thread_t* thread)
+{
+    ioctl(thread->epoch_counter_fd, PERF_EVENT_IOC_REFRESH, 1);
+}
+
 void thread_interrupt_handler(int signum)
 {
-    DBG_LOG(DEBUG, "Handling interrupt thread [%d] pthread: 0x%lx\n", thread_self()->tid, thread_self()->pthread);
+    thread_t* thread = thread_self();
+    hrtime_t now = hrtime_now();
+    hrtime_t elapsed;
+
+    if (!thread) {
+        return;
+    }
+
+    account_signal_delivery(thread, now);
+
+    // the interrupted code is creating an epoch already (e.g. called from a 
+    // critical section), it will also reset the signaled flag and the epoch
+    // start, so the timer has a whole epoch to go
+    if (thread->in_epoch) {
+        if (thread->has_epoch_timer) {
+            arm_epoch_timer(thread, thread->max_epoch_cycles);
+        } else if (thread->has_epoch_counter) {
+            arm_epoch_counter(thread);
+        }
+        return;
+    }
+
+    if (thread->has_epoch_timer) {
+        // epochs closed at interposed locks do not touch the timer, the
+        // remaining time is only accounted for when it expires
+        elapsed = now - thread->last_epoch_timestamp;
+        if (elapsed < thread->max_epoch_cycles) {
+            arm_epoch_timer(thread, thread->max_epoch_cycles - elapsed);
+            return;
+        }
+#ifdef USE_STATISTICS
+        if (thread_manager->stats.enabled) {
+            thread->stats.signals_sent++;
+        }
+#endif
+    }
+#ifdef USE_STATISTICS
+    if (thread->has_epoch_counter && thread_manager->stats.enabled) {
+        thread->stats.signals_sent++;
+    }
+#endif
+
+    DBG_LOG(DEBUG, "Handling interrupt thread [%d] pthread: 0x%lx\n", thread->tid, thread->pthread);
 
     create_latency_epoch();
+
+    if (thread->has_epoch_timer) {
+        arm_epoch_timer(thread, thread->max_epoch_cycles);
+    } else if (thread->has_epoch_counter) {
+        arm_epoch_counter(thread);
+    }
 }
 
-#ifdef PAPI_SUPPORT
-static int setup_events_thread_self(thread_t *thread, const char **native_events) {
-    int i;
+static int create_epoch_timer(thread_t* thread)
+{
+    struct sigevent sev;
 
-    // create event set for this thread
-    if (pmc_create_event_set_local_thread() != 0) {
-       return -1;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGUSR1;
+    sev.sigev_notify_thread_id = thread->tid;
+    if (timer_create(CLOCK_MONOTONIC, &sev, &thread->epoch_timer) != 0) {
+        return E_ERROR;
     }
+    thread->has_epoch_timer = 1;
+    return E_SUCCESS;
+}
 
-    // register events for this thread
-    for (i = 0; i < MAX_NUM_EVENTS; ++i) {
-   	    if (native_events[i]) {
-            DBG_LOG(INFO, "registering event %s, thread id [%d]\n", native_events[i], thread->tid);
-            if (pmc_register_event_local_thread(native_events[i]) != 0) {
-                return E_ERROR;
-            }
+static int open_epoch_counter(thread_t* thread, int trigger, uint64_t period)
+{
+    struct perf_event_attr attr;
+    struct f_owner_ex owner;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    if (trigger == EPOCH_TRIGGER_TASK_CLOCK) {
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = PERF_COUNT_SW_TASK_CLOCK;
+    } else {
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = trigger == EPOCH_TRIGGER_LLC_MISSES ? PERF_COUNT_HW_CACHE_MISSES : PERF_COUNT_HW_INSTRUCTIONS;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+    }
+    attr.sample_period = period;
+    attr.wakeup_events = 1;
+    attr.disabled = 1; // until armed
+
+    if ((fd = (int) syscall(__NR_perf_event_open, &attr, thread->tid, -1, -1, 0)) < 0) {
+        return -1;
+    }
+    // overflows signal the thread itself, like its timer
+    owner.type = F_OWNER_TID;
+    owner.pid = thread->tid;
+    if (fcntl(fd, F_SETOWN_EX, &owner) != 0 || fcntl(fd, F_SETSIG, SIGUSR1) != 0 ||
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_ASYNC) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Epochs of the thread close every epoch_trigger_period events instead of on
+// time. Without the hardware event, they follow the CPU time of the thread.
+static int create_epoch_counter(thread_t* thread)
+{
+    int fd;
+
+    fd = open_epoch_counter(thread, thread_manager->epoch_trigger, thread_manager->epoch_trigger_period);
+    if (fd < 0 && thread_manager->epoch_trigger != EPOCH_TRIGGER_TASK_CLOCK) {
+        DBG_LOG(WARNING, "thread id [%d] cannot count its events, its epochs follow its CPU time\n", thread->tid);
+        fd = open_epoch_counter(thread, EPOCH_TRIGGER_TASK_CLOCK,
+                                (uint64_t) thread_manager->max_epoch_duration_us * NANOS_PER_USEC);
+    }
+    if (fd < 0) {
+        return E_ERROR;
+    }
+    thread->epoch_counter_fd = fd;
+    thread->has_epoch_counter = 1;
+    return E_SUCCESS;
+}
+
+static void deadline_heap_swap(thread_manager_t* manager, int i, int j)
+{
+    thread_t* tmp = manager->deadline_heap[i];
+
+    manager->deadline_heap[i] = manager->deadline_heap[j];
+    manager->deadline_heap[j] = tmp;
+    manager->deadline_heap[i]->heap_index = i;
+    manager->deadline_heap[j]->heap_index = j;
+}
+
+static void deadline_heap_sift_up(thread_manager_t* manager, int i)
+{
+    thread_t** heap = manager->deadline_heap;
+
+    while (i > 0 && heap[(i-1)/2]->monitor_deadline > heap[i]->monitor_deadline) {
+        deadline_heap_swap(manager, i, (i-1)/2);
+        i = (i-1)/2;
+    }
+}
+
+static void deadline_heap_sift_down(thread_manager_t* manager, int i)
+{
+    thread_t** heap = manager->deadline_heap;
+    int smallest;
+
+    while (1) {
+        smallest = i;
+        if (2*i+1 < manager->deadline_heap_size && heap[2*i+1]->monitor_deadline < heap[smallest]->monitor_deadline) {
+            smallest = 2*i+1;
         }
+        if (2*i+2 < manager->deadline_heap_size && heap[2*i+2]->monitor_deadline < heap[smallest]->monitor_deadline) {
+            smallest = 2*i+2;
+        }
+        if (smallest == i) {
+            break;
+        }
+        deadline_heap_swap(manager, i, smallest);
+        i = smallest;
     }
+}
 
-    // start event counting for this thread
-    if (pmc_events_start_local_thread() != 0) {
-    	return E_ERROR;
+// all deadline heap functions are called with the manager mutex held
+static int deadline_heap_insert(thread_manager_t* manager, thread_t* thread)
+{
+    thread_t** heap;
+    int capacity;
+
+    if (manager->deadline_heap_size == manager->deadline_heap_capacity) {
+        capacity = manager->deadline_heap_capacity ? 2 * manager->deadline_heap_capacity : 64;
+        if (!(heap = realloc(manager->deadline_heap, capacity * sizeof(thread_t*)))) {
+            return E_ERROR;
+        }
+        manager->deadline_heap = heap;
+        manager->deadline_heap_capacity = capacity;
     }
 
-    pmc_register_thread();
+    thread->monitor_deadline = thread->last_epoch_timestamp + thread->max_epoch_cycles;
+    thread->heap_index = manager->deadline_heap_size++;
+    manager->deadline_heap[thread->heap_index] = thread;
+    deadline_heap_sift_up(manager, thread->heap_index);
+    return E_SUCCESS;
+}
 
-    return 0;
+static void deadline_heap_remove(thread_manager_t* manager, thread_t* thread)
+{
+    int i = thread->heap_index;
+
+    if (i < 0) {
+        return;
+    }
+    thread->heap_index = -1;
+    if (i == --manager->deadline_heap_size) {
+        return;
+    }
+    manager->deadline_heap[i] = manager->deadline_heap[manager->deadline_heap_size];
+    manager->deadline_heap[i]->heap_index = i;
+    deadline_heap_sift_up(manager, i);
+    deadline_heap_sift_down(manager, manager->deadline_heap[i]->heap_index);
 }
-#endif
+
+static void start_monitor_thread(thread_manager_t* manager);
 
 int register_thread(thread_manager_t* thread_manager, pthread_t pthread, pid_t tid)
 {
     int ret = 0;
     int cpu_id;
     int virtual_node_id;
-    thread_t* thread = malloc(sizeof(thread_t));
+    unsigned int ticket;
+    thread_t* thread;
 
     if (thread_manager == NULL) {
         // this is possible if both BW and latency modeling are enabled and the BW model is not yet created.
@@ -191,16 +452,27 @@ int register_thread(thread_manager_t* thread_manager, pthread_t pthread, pid_t t
         return E_SUCCESS;
     }
 
-    memset(thread, 0, sizeof(thread_t));
+    // the virtual node is chosen first so that the descriptor comes from the
+    // memory node the thread will run on
+    ticket = __sync_fetch_and_add(&thread_manager->next_cpu_ticket, 1);
+    virtual_node_id = thread_manager->cpu_ring[ticket % thread_manager->cpu_ring_size].virtual_node_id;
+    cpu_id = thread_manager->cpu_ring[ticket % thread_manager->cpu_ring_size].cpu_id;
+    if (!(thread = thread_pool_get(&thread_manager->thread_pools[virtual_node_id]))) {
+        DBG_LOG(ERROR, "thread id [%d] failed to register with Monitor Thread\n", tid);
+        return E_ERROR;
+    }
 
     thread->pthread = pthread;
     thread->tid = tid;
     thread->thread_manager = thread_manager;
 
+    thread->last_epoch_timestamp = hrtime_now();
+    thread->max_epoch_cycles = thread_manager->max_epoch_duration_cycles;
+    thread->min_epoch_cycles = thread_manager->min_epoch_duration_cycles;
+    thread->heap_index = -1;
 #ifdef USE_STATISTICS
     if (thread_manager->stats.enabled) {
-        thread->stats.last_epoch_timestamp = monotonic_time_us();
-        thread->stats.shortest_epoch_duration_us = UINT64_MAX;
+        thread->stats.shortest_epoch_duration_cycles = UINT64_MAX;
     }
 #endif
 
@@ -212,77 +484,117 @@ int register_thread(thread_manager_t* thread_manager, pthread_t pthread, pid_t t
     sigaction (SIGUSR1, &sa, NULL);
 
     // bind the thread on a cpu and memory node and
-    // link the thread to the list of threads
-    assert(__lib_pthread_mutex_lock);
-    __lib_pthread_mutex_lock(&thread_manager->mutex);
-    rr_next_cpu_id(thread_manager, &virtual_node_id, &cpu_id);
+    // publish the thread in the registry
     if ((ret = bind_thread_on_cpu(thread_manager, thread, virtual_node_id, cpu_id)) != E_SUCCESS) {
-    	__lib_pthread_mutex_unlock(&thread_manager->mutex);
     	DBG_LOG(ERROR, "thread id [%d] failed to bind to CPU\n", thread->tid);
         goto error;
     }
     if ((ret = bind_thread_on_mem(thread_manager, thread, virtual_node_id, cpu_id)) != E_SUCCESS) {
-    	__lib_pthread_mutex_unlock(&thread_manager->mutex);
     	DBG_LOG(ERROR, "thread id [%d] failed to bind to Memory\n", thread->tid);
         goto error;
     }
     thread->cpu_id = cpu_id;
     thread->cpu_speed_mhz = cpu_speed_mhz();
-#ifdef PAPI_SUPPORT
-    cpu_model_t *cpu = thread_manager->virtual_topology->virtual_nodes[virtual_node_id].dram_node->cpu_model;
-    if (setup_events_thread_self(thread, cpu->pmc_events.native_events) != 0) {
+    if ((ret = pmc_open_thread(latency_model.pmc_events, &thread->pmc, tid)) != E_SUCCESS) {
+        DBG_LOG(ERROR, "thread id [%d] cannot read its performance counters\n", thread->tid);
+        goto error;
+    }
+    if ((thread->registry_slot = thread_registry_add(&thread_manager->registry, thread)) < 0) {
+        DBG_LOG(WARNING, "thread id [%d] cannot be registered, latency.max_threads (%d) threads are running\n",
+                thread->tid, thread_manager->max_threads);
         ret = E_ERROR;
-        __lib_pthread_mutex_unlock(&thread_manager->mutex);
         goto error;
     }
-#endif
-    LL_APPEND(thread_manager->thread_list, thread);
+    if (thread_manager->epoch_trigger != EPOCH_TRIGGER_TIME && create_epoch_counter(thread) != E_SUCCESS) {
+        DBG_LOG(WARNING, "thread id [%d] failed to create its epoch counter, its epochs are timed\n", thread->tid);
+    }
+    if (!thread->has_epoch_counter &&
+            (!thread_manager->per_thread_timers || create_epoch_timer(thread) != E_SUCCESS)) {
+        if (thread_manager->per_thread_timers) {
+            DBG_LOG(WARNING, "thread id [%d] failed to create its epoch timer, falling back to the monitor thread\n", thread->tid);
+        }
+        assert(__lib_pthread_mutex_lock);
+        __lib_pthread_mutex_lock(&thread_manager->mutex);
+        start_monitor_thread(thread_manager);
+        if (deadline_heap_insert(thread_manager, thread) != E_SUCCESS) {
+            __lib_pthread_mutex_unlock(&thread_manager->mutex);
+            thread_registry_remove(&thread_manager->registry, thread->registry_slot);
+            DBG_LOG(ERROR, "thread id [%d] failed to join the monitor\n", thread->tid);
+            ret = E_ERROR;
+            goto error;
+        }
+        // the new deadline may be earlier than the one the monitor sleeps on
+        pthread_cond_signal(&thread_manager->monitor_cond);
+        __lib_pthread_mutex_unlock(&thread_manager->mutex);
+    }
 #ifdef USE_STATISTICS
     if (thread_manager->stats.enabled) {
-        thread_manager->stats.n_threads++;
+        __sync_fetch_and_add(&thread_manager->stats.n_threads, 1);
         thread->stats.register_timestamp = monotonic_time_us();
     }
 #endif
-    __lib_pthread_mutex_unlock(&thread_manager->mutex);
 
     init_thread_latency_model(thread);
+    if (epoch_log_open(thread) != E_SUCCESS) {
+        DBG_LOG(WARNING, "thread id [%d] epochs will not be recorded\n", thread->tid);
+    }
+    if (read_sampler_open(thread) != E_SUCCESS) {
+        DBG_LOG(WARNING, "thread id [%d] misses will not feed the read buffer\n", thread->tid);
+    }
 
     tls_thread = thread;
 
+    // the handler ignores signals until tls_thread is set
+    if (thread->has_epoch_timer) {
+        arm_epoch_timer(thread, thread->max_epoch_cycles);
+    } else if (thread->has_epoch_counter) {
+        arm_epoch_counter(thread);
+    }
+
     return E_SUCCESS;
 
 error:
-    free(thread);
     DBG_LOG(ERROR, "thread id [%d] failed to register with Monitor Thread\n", thread->tid);
+    pmc_close_thread(latency_model.pmc_events, &thread->pmc);
+    thread_pool_put(thread->pool, thread);
     return ret;
 }
 
 
 int unregister_thread(thread_manager_t* thread_manager, thread_t * thread)
 {
-    __lib_pthread_mutex_lock(&thread_manager->mutex);
+    if (thread->has_epoch_timer) {
+        timer_delete(thread->epoch_timer);
+        thread->has_epoch_timer = 0;
+    }
+    if (thread->has_epoch_counter) {
+        thread->has_epoch_counter = 0;
+        close(thread->epoch_counter_fd);
+    }
+
+    epoch_log_close(thread);
+    read_sampler_close(thread);
+    pmc_close_thread(latency_model.pmc_events, &thread->pmc);
 
     if (thread_manager == NULL) {
         return E_SUCCESS;
     }
 
-    LL_DELETE(thread_manager->thread_list, thread);
+    thread_registry_remove(&thread_manager->registry, thread->registry_slot);
+    if (thread->heap_index >= 0) {
+        __lib_pthread_mutex_lock(&thread_manager->mutex);
+        deadline_heap_remove(thread_manager, thread);
+        __lib_pthread_mutex_unlock(&thread_manager->mutex);
+    }
 
 #ifdef USE_STATISTICS
     if (thread_manager->stats.enabled) {
         thread->stats.unregister_timestamp = monotonic_time_us();
-        LL_APPEND(thread_manager->stats.thread_list, thread);
+        thread->stats.virtual_time_offset_us = thread->virtual_time_offset / thread_manager->tsc_mhz;
+        stats_fold_thread_stats(&thread->pool->terminated, &thread->stats);
     }
 #endif
 
-    __lib_pthread_mutex_unlock(&thread_manager->mutex);
-
-#ifdef PAPI_SUPPORT
-    pmc_events_stop_local_thread();
-    pmc_destroy_event_set_local_thread();
-    pmc_unregister_thread();
-#endif
-
     return E_SUCCESS;
 }
 
@@ -302,66 +614,113 @@ int register_self()
 
 int unregister_self()
 {
-	if (tls_thread) {
-	    unregister_thread(thread_manager, tls_thread);
+	thread_t* thread = tls_thread;
 
-#ifdef USE_STATISTICS
-	    if (!thread_manager->stats.enabled) {
-		    // statistics makes use of the thread descriptor
-            free(tls_thread);
-	    }
-#else
-	    free(tls_thread);
-#endif
+	if (thread) {
+	    unregister_thread(thread_manager, thread);
+
+	    // a signal still pending must not see the descriptor once it is recycled
         tls_thread = NULL;
+        __asm__ __volatile__ ("" ::: "memory");
+        thread_pool_put(thread->pool, thread);
 	}
 
     return E_SUCCESS;
 }
 
-static int reached_max_epoch_duration(thread_t* thread);
-void interrupt_threads(thread_manager_t* manager)
+// Interrupts the threads whose deadline has passed and returns the earliest
+// deadline left. Epochs closed at interposed locks move last_epoch_timestamp
+// without touching the heap, so a stale entry is only re-keyed when it reaches
+// the top.
+static hrtime_t interrupt_threads(thread_manager_t* manager)
 {
     thread_t* thread;
+    hrtime_t now;
+    hrtime_t deadline;
+
+    while (manager->deadline_heap_size > 0) {
+        thread = manager->deadline_heap[0];
+        now = hrtime_now();
+        if (thread->monitor_deadline > now) {
+            return thread->monitor_deadline;
+        }
 
-    assert(__lib_pthread_mutex_lock);
-    __lib_pthread_mutex_lock(&manager->mutex);
-    LL_FOREACH(manager->thread_list, thread)
-    {
-    	assert(thread);
-        if (thread->signaled == 0 && reached_max_epoch_duration(thread)) {
-            DBG_LOG(DEBUG, "interrupting thread [%d]\n", thread->tid);
+        // last_epoch_timestamp is set by the thread itself, possibly on another
+        // processor, which is fine as long as the TSC is invariant
+        deadline = thread->last_epoch_timestamp + thread->max_epoch_cycles;
+        if (deadline > now) {
+            thread->monitor_deadline = deadline;
+        } else {
+            if (thread->signaled == 0) {
+                DBG_LOG(DEBUG, "interrupting thread [%d]\n", thread->tid);
 #ifdef USE_STATISTICS
-            if (manager->stats.enabled) {
-                thread->stats.signals_sent++;
-            }
+                if (manager->stats.enabled) {
+                    thread->stats.signals_sent++;
+                }
 #endif
-            // this flag must be set before the signal is sent to make sure
-            // there will be no race condition
-            thread->signaled = 1;
-            pthread_kill(thread->pthread, SIGUSR1);
+                // this flag must be set before the signal is sent to make sure
+                // there will be no race condition
+                thread->signaled = 1;
+                thread->signal_timestamp = hrtime_now();
+                pthread_kill(thread->pthread, SIGUSR1);
+            }
+            // check again one epoch later, the new epoch start is seen then
+            thread->monitor_deadline = now + thread->max_epoch_cycles;
         }
+        deadline_heap_sift_down(manager, 0);
     }
-    assert(__lib_pthread_mutex_unlock);
-    __lib_pthread_mutex_unlock(&manager->mutex);
+
+    return 0;
 }
 
 void* monitor_thread(void* arg)
 {
     thread_manager_t* manager = (thread_manager_t*) arg;
-    struct timespec epoch_duration;
-//    time_t secs = thread_manager->max_epoch_duration_us / USECS_PER_SEC;
-//    long nanosecs = (thread_manager->max_epoch_duration_us % USECS_PER_SEC) * NANOS_PER_USEC;
+    struct timespec wakeup;
+    hrtime_t deadline;
+    hrtime_t now;
+    uint64_t ns;
 
-    epoch_duration.tv_sec = 0;
-    epoch_duration.tv_nsec = MIN_EPOCH_DURATION_US * 1000;
+    assert(__lib_pthread_mutex_lock);
+    __lib_pthread_mutex_lock(&manager->mutex);
     while(1) {
-        nanosleep(&epoch_duration, NULL);
-        interrupt_threads(manager);
+        deadline = interrupt_threads(manager);
+        if (deadline == 0) {
+            // no thread left to monitor
+            pthread_cond_wait(&manager->monitor_cond, &manager->mutex);
+            continue;
+        }
+
+        // sleep until the earliest deadline or until a thread is registered
+        now = hrtime_now();
+        ns = deadline > now ? ((deadline - now) * NANOS_PER_USEC) / manager->tsc_mhz : 0;
+        undilated_clock_gettime(CLOCK_MONOTONIC, &wakeup);
+        ns += wakeup.tv_nsec;
+        wakeup.tv_sec += ns / (USECS_PER_SEC * NANOS_PER_USEC);
+        wakeup.tv_nsec = ns % (USECS_PER_SEC * NANOS_PER_USEC);
+        pthread_cond_timedwait(&manager->monitor_cond, &manager->mutex, &wakeup);
     }
+    __lib_pthread_mutex_unlock(&manager->mutex);
     return NULL;
 }
 
+// started on demand, only threads without an epoch timer need it;
+// called with the manager mutex held
+static void start_monitor_thread(thread_manager_t* manager)
+{
+    pthread_t monitor_tid;
+
+    if (manager->monitor_started) {
+        return;
+    }
+
+    assert(__lib_pthread_create);
+    assert(__lib_pthread_detach);
+    __lib_pthread_create(&monitor_tid, NULL, monitor_thread, (void*) manager);
+    __lib_pthread_detach(monitor_tid);
+    manager->monitor_started = 1;
+}
+
 static void set_epoch_duration(config_t* cfg, const char *config_str, int *epoch_us, int default_epoch_us) {
     if (__cconfig_lookup_int(cfg, config_str, epoch_us) != CONFIG_TRUE) {
     	*epoch_us = default_epoch_us;
@@ -378,11 +737,139 @@ static void set_epoch_duration(config_t* cfg, const char *config_str, int *epoch
     }
 }
 
+static void set_epoch_trigger(config_t* cfg, thread_manager_t* mgr)
+{
+    char* trigger;
+    int period;
+
+    mgr->epoch_trigger = EPOCH_TRIGGER_TIME;
+    if (__cconfig_lookup_string(cfg, "latency.epoch_trigger", &trigger) != CONFIG_TRUE ||
+            strcmp(trigger, "time") == 0) {
+        return;
+    }
+    if (strcmp(trigger, "llc_misses") == 0) {
+        mgr->epoch_trigger = EPOCH_TRIGGER_LLC_MISSES;
+        mgr->epoch_trigger_period = DEFAULT_EPOCH_TRIGGER_MISSES;
+    } else if (strcmp(trigger, "instructions") == 0) {
+        mgr->epoch_trigger = EPOCH_TRIGGER_INSTRUCTIONS;
+        mgr->epoch_trigger_period = DEFAULT_EPOCH_TRIGGER_INSTRUCTIONS;
+    } else if (strcmp(trigger, "task_clock") == 0) {
+        mgr->epoch_trigger = EPOCH_TRIGGER_TASK_CLOCK;
+        mgr->epoch_trigger_period = (uint64_t) mgr->max_epoch_duration_us * NANOS_PER_USEC;
+    } else {
+        DBG_LOG(WARNING, "Unknown latency.epoch_trigger %s, epochs are timed\n", trigger);
+        return;
+    }
+    // the module programs the general-purpose counters of every processor
+    // behind perf's back, a perf counter may be given one of them
+    if (mgr->epoch_trigger != EPOCH_TRIGGER_TASK_CLOCK &&
+            latency_model.pmc_events->backend == &pmc_nvmemul_backend) {
+        mgr->epoch_trigger = EPOCH_TRIGGER_TASK_CLOCK;
+        mgr->epoch_trigger_period = (uint64_t) mgr->max_epoch_duration_us * NANOS_PER_USEC;
+        DBG_LOG(WARNING, "latency.epoch_trigger %s needs latency.pmc_backend perf, epochs close every "
+                "%lu nsec of CPU time instead\n", trigger, mgr->epoch_trigger_period);
+        return;
+    }
+    if (__cconfig_lookup_int(cfg, "latency.epoch_trigger_period", &period) == CONFIG_TRUE && period > 0) {
+        mgr->epoch_trigger_period = period;
+    }
+    DBG_LOG(INFO, "Epochs close every %lu %s\n", mgr->epoch_trigger_period, trigger);
+}
+
+// TSC frequency measured against the monotonic clock; /proc/cpuinfo reports 
+// the current core frequency instead
+static int calibrate_tsc_mhz()
+{
+    struct timespec start_ts, stop_ts;
+    struct timespec duration = { 0, 10 * NANOS_PER_USEC * 1000 };
+    hrtime_t start, stop;
+    uint64_t elapsed_ns;
+
+    undilated_clock_gettime(CLOCK_MONOTONIC, &start_ts);
+    start = hrtime_now();
+    nanosleep(&duration, NULL);
+    undilated_clock_gettime(CLOCK_MONOTONIC, &stop_ts);
+    stop = hrtime_now();
+
+    elapsed_ns = (stop_ts.tv_sec - start_ts.tv_sec) * USECS_PER_SEC * NANOS_PER_USEC +
+                 (stop_ts.tv_nsec - start_ts.tv_nsec);
+    return (int) (((stop - start) * NANOS_PER_USEC) / elapsed_ns);
+}
+
+static volatile hrtime_t calibration_handler_timestamp;
+
+static void calibration_handler(int signum)
+{
+    calibration_handler_timestamp = hrtime_now();
+}
+
+static void sort_cycles(hrtime_t* cycles, int n)
+{
+    hrtime_t c;
+    int i, j;
+
+    for (i = 1; i < n; i++) {
+        c = cycles[i];
+        for (j = i; j > 0 && cycles[j-1] > c; j--) {
+            cycles[j] = cycles[j-1];
+        }
+        cycles[j] = c;
+    }
+}
+
+// Measures the median cost of delivering a signal and of returning from its
+// handler with signals sent to self, on a spare signal whose action is restored
+static void calibrate_signal_cost(thread_manager_t* mgr)
+{
+    struct sigaction sa, old_sa;
+    hrtime_t delivery[SIGNAL_CALIBRATION_ROUNDS];
+    hrtime_t ret[SIGNAL_CALIBRATION_ROUNDS];
+    hrtime_t start, end;
+    int i;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &calibration_handler;
+    if (sigaction(SIGUSR2, &sa, &old_sa) != 0) {
+        return;
+    }
+    for (i = 0; i < SIGNAL_CALIBRATION_ROUNDS; i++) {
+        calibration_handler_timestamp = 0;
+        start = hrtime_now();
+        pthread_kill(pthread_self(), SIGUSR2);
+        end = hrtime_now();
+        if (calibration_handler_timestamp < start || calibration_handler_timestamp > end) {
+            // blocked or handled elsewhere, nothing is charged
+            sigaction(SIGUSR2, &old_sa, NULL);
+            return;
+        }
+        delivery[i] = calibration_handler_timestamp - start;
+        ret[i] = end - calibration_handler_timestamp;
+    }
+    sigaction(SIGUSR2, &old_sa, NULL);
+
+    sort_cycles(delivery, SIGNAL_CALIBRATION_ROUNDS);
+    sort_cycles(ret, SIGNAL_CALIBRATION_ROUNDS);
+    mgr->signal_delivery_cycles = delivery[SIGNAL_CALIBRATION_ROUNDS / 2];
+    mgr->signal_return_cycles = ret[SIGNAL_CALIBRATION_ROUNDS / 2];
+}
+
+static int has_invariant_tsc()
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0) {
+        return 0;
+    }
+    return (edx >> 8) & 1;
+}
+
 int init_thread_manager(config_t* cfg, virtual_topology_t* virtual_topology)
 {
     int ret;
-    pthread_t monitor_tid;
+    int i;
+    int epoch_delay_target_us;
     thread_manager_t* mgr;
+    pthread_condattr_t condattr;
     virtual_node_t* virtual_node;
     physical_node_t* physical_node;
 
@@ -393,7 +880,6 @@ int init_thread_manager(config_t* cfg, virtual_topology_t* virtual_topology)
 
     memset(mgr, 0, sizeof(thread_manager_t));
 
-    mgr->thread_list = NULL;
     mgr->virtual_topology = virtual_topology;
     mgr->next_virtual_node_id = 0;
 
@@ -406,16 +892,68 @@ int init_thread_manager(config_t* cfg, virtual_topology_t* virtual_topology)
         mgr->min_epoch_duration_us = MIN_EPOCH_DURATION_US;
     }
 
+    if (!has_invariant_tsc()) {
+        DBG_LOG(WARNING, "Processor has no invariant TSC, epoch durations may be inaccurate\n");
+    }
+    mgr->tsc_mhz = calibrate_tsc_mhz();
+    mgr->max_epoch_duration_cycles = (hrtime_t) mgr->max_epoch_duration_us * mgr->tsc_mhz;
+    mgr->min_epoch_duration_cycles = (hrtime_t) mgr->min_epoch_duration_us * mgr->tsc_mhz;
+    DBG_LOG(INFO, "TSC frequency is %d MHz\n", mgr->tsc_mhz);
+
+    calibrate_signal_cost(mgr);
+    DBG_LOG(INFO, "signal delivery %lu cycles, return from handler %lu cycles\n",
+            mgr->signal_delivery_cycles, mgr->signal_return_cycles);
+
+    __cconfig_lookup_bool(cfg, "latency.adaptive_epochs", &mgr->adaptive_epochs);
+    if (__cconfig_lookup_int(cfg, "latency.overhead_budget_percent", &mgr->overhead_budget_percent) != CONFIG_TRUE ||
+            mgr->overhead_budget_percent <= 0) {
+        mgr->overhead_budget_percent = DEFAULT_OVERHEAD_BUDGET_PERCENT;
+    }
+    if (__cconfig_lookup_int(cfg, "latency.epoch_delay_target_us", &epoch_delay_target_us) != CONFIG_TRUE ||
+            epoch_delay_target_us <= 0) {
+        epoch_delay_target_us = DEFAULT_EPOCH_DELAY_TARGET_US;
+    }
+    mgr->epoch_delay_target_cycles = (hrtime_t) epoch_delay_target_us * mgr->tsc_mhz;
+
     virtual_node = &virtual_topology->virtual_nodes[mgr->next_virtual_node_id];
     physical_node = virtual_node->dram_node;
     mgr->next_cpu_id = first_cpu(physical_node->cpu_bitmask);
+    if (build_cpu_ring(mgr) != E_SUCCESS) {
+        ret = E_ERROR;
+        goto done;
+    }
+
+    if (__cconfig_lookup_int(cfg, "latency.max_threads", &mgr->max_threads) != CONFIG_TRUE ||
+            mgr->max_threads <= 0) {
+        mgr->max_threads = DEFAULT_MAX_THREADS;
+    }
+    if (thread_registry_init(&mgr->registry, mgr->max_threads) != E_SUCCESS) {
+        ret = E_ERROR;
+        goto done;
+    }
+
+    if (!(mgr->thread_pools = malloc(virtual_topology->num_virtual_nodes * sizeof(thread_pool_t)))) {
+        ret = E_ERROR;
+        goto done;
+    }
+    for (i = 0; i < virtual_topology->num_virtual_nodes; i++) {
+        thread_pool_init(&mgr->thread_pools[i], virtual_topology->virtual_nodes[i].dram_node->node_id);
+    }
+
     pthread_mutex_init(&mgr->mutex, NULL);
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&mgr->monitor_cond, &condattr);
+    pthread_condattr_destroy(&condattr);
 
-    // fire a monitoring thread that periodically interrupts threads
-    assert(__lib_pthread_create);
-    assert(__lib_pthread_detach);
-    __lib_pthread_create(&monitor_tid, NULL, monitor_thread, (void*) mgr);
-    __lib_pthread_detach(monitor_tid);
+    if (__cconfig_lookup_bool(cfg, "latency.per_thread_timers", &mgr->per_thread_timers) != CONFIG_TRUE) {
+        mgr->per_thread_timers = 1;
+    }
+    set_epoch_trigger(cfg, mgr);
+    if (!mgr->per_thread_timers) {
+        // fire a monitoring thread that periodically interrupts threads
+        start_monitor_thread(mgr);
+    }
 
     thread_manager = mgr;
     return E_SUCCESS;
@@ -425,9 +963,7 @@ done:
 }
 
 int reached_min_epoch_duration(thread_t* thread) {
-	double current_time;
-	uint64_t diff_us;
-	int result = 0;
+	hrtime_t diff;
 
     if (thread == NULL) {
     	// FIXME: JVM for instance create threads using a mechanism not traced by this emulator
@@ -438,69 +974,74 @@ int reached_min_epoch_duration(thread_t* thread) {
         	// if the thread could not be registered, exit this function
         	return 0;
         thread = thread_self();
+        if (thread == NULL)
+        	return 0;
     }
 
-	current_time = monotonic_time_us();
-
-#ifdef USE_STATISTICS
-    diff_us = (uint64_t) (current_time - thread->stats.last_epoch_timestamp);
-#else
-    diff_us = (uint64_t) (current_time - thread->last_epoch_timestamp);
-#endif
-
-    DBG_LOG(DEBUG, "thread id [%d] last epoch was %lu usec ago\n", thread->tid, diff_us);
-
-    if(diff_us >= thread_manager->min_epoch_duration_us) {
-    	DBG_LOG(DEBUG, "thread id [%d] reached min epoch duration (%i usec)\n", thread->tid,
-    			thread_manager->min_epoch_duration_us);
-        result = 1;
+    // called on every interposed lock/unlock, keep it free of system calls
+    diff = hrtime_now() - thread->last_epoch_timestamp;
+    if (diff >= thread->min_epoch_cycles) {
+        return 1;
     }
 #ifdef USE_STATISTICS
-    if (thread_manager->stats.enabled && ! result) {
+    if (thread_manager->stats.enabled) {
     	thread->stats.min_epoch_not_reached++;
     }
 #endif
-    return result;
+    return 0;
 }
 
-static int reached_max_epoch_duration(thread_t* thread) {
-	double current_time;
-	uint64_t diff_us;
-	int result = 0;
-
-	// it compares this time with the last_epoch_timestamp, which is set by another thread
-	// so, this time must be based on a system time and not on CPU cycles/time registers
-	current_time = monotonic_time_us();
+// Called at the end of every epoch with its overhead and delay. Once per
+// window the thread's epochs are made
+// - longer (both durations doubled) if the overhead is above budget, the
+//   emulation costs more than the accuracy it buys;
+// - shorter (max duration halved) if epochs inject more delay than the target,
+//   large delays bunch up the stalls of a whole epoch at one point in time;
+// - closer to lock timing (min duration halved) if the overhead is well within
+//   budget, so critical sections end epochs again.
+void adapt_epoch_duration(thread_t* thread, uint64_t overhead_cycles, uint64_t delay_cycles)
+{
+    thread_manager_t* manager = thread->thread_manager;
+    uint64_t overhead, delay;
 
-#ifdef USE_STATISTICS
-    diff_us = (uint64_t) (current_time - thread->stats.last_epoch_timestamp);
-#else
-    diff_us = (uint64_t) (current_time - thread->last_epoch_timestamp);
-#endif
+    if (!manager->adaptive_epochs) {
+        return;
+    }
 
-    DBG_LOG(DEBUG, "thread id [%d] last epoch was %lu usec ago\n", thread->tid, diff_us);
+    thread->adapt_overhead_cycles += overhead_cycles;
+    thread->adapt_delay_cycles += delay_cycles;
+    if (++thread->adapt_epochs < ADAPT_WINDOW_EPOCHS) {
+        return;
+    }
 
-    if(diff_us >= thread_manager->max_epoch_duration_us) {
-    	DBG_LOG(DEBUG, "thread id [%d] reached max epoch duration (%i usec)\n", thread->tid,
-    			thread_manager->max_epoch_duration_us);
-        result = 1;
+    overhead = thread->adapt_overhead_cycles * 100;
+    delay = thread->adapt_delay_cycles * manager->overhead_budget_percent;
+    if (overhead > delay) {
+        thread->max_epoch_cycles = thread->max_epoch_cycles * 2 < manager->max_epoch_duration_cycles ?
+                thread->max_epoch_cycles * 2 : manager->max_epoch_duration_cycles;
+        thread->min_epoch_cycles = thread->min_epoch_cycles * 2 < thread->max_epoch_cycles ?
+                thread->min_epoch_cycles * 2 : thread->max_epoch_cycles;
+    } else if (thread->adapt_delay_cycles / ADAPT_WINDOW_EPOCHS > manager->epoch_delay_target_cycles) {
+        thread->max_epoch_cycles = thread->max_epoch_cycles / 2 > manager->min_epoch_duration_cycles ?
+                thread->max_epoch_cycles / 2 : manager->min_epoch_duration_cycles;
+        if (thread->min_epoch_cycles > thread->max_epoch_cycles) {
+            thread->min_epoch_cycles = thread->max_epoch_cycles;
+        }
+    } else if (overhead * 4 < delay) {
+        thread->min_epoch_cycles = thread->min_epoch_cycles / 2 > manager->min_epoch_duration_cycles ?
+                thread->min_epoch_cycles / 2 : manager->min_epoch_duration_cycles;
     }
 
-    return result;
-}
+    DBG_LOG(DEBUG, "thread id [%d] epoch durations adapted to [%lu, %lu] cycles\n", thread->tid,
+            thread->min_epoch_cycles, thread->max_epoch_cycles);
 
-void block_new_epoch() {
-    sigset_t set;
-    sigemptyset(&set);
-    sigaddset(&set, SIGUSR1);
-    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    thread->adapt_epochs = 0;
+    thread->adapt_overhead_cycles = 0;
+    thread->adapt_delay_cycles = 0;
 }
 
-void unblock_new_epoch() {
-    sigset_t set;
-    sigemptyset(&set);
-    sigaddset(&set, SIGUSR1);
-    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+int tsc_mhz() {
+	return thread_manager ? thread_manager->tsc_mhz : 0;
 }
 
 thread_manager_t* get_thread_manager() {
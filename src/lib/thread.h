@@ -18,45 +18,135 @@ Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 #include <stdint.h>
 #include <numa.h>
 #include <pthread.h>
+#include <time.h>
 #include <libconfig.h>
 #include "topology.h"
 #include "cpu/cpu.h"
+#include "cpu/pmc.h"
+#include "model_lat.h"
 #include "stat.h"
+#include "registry.h"
 
 
 struct thread_manager_s; // opaque
+struct thread_pool_s;
+struct epoch_log_s;
+struct read_sampler_s;
 
 typedef uint64_t hrtime_t;
 
 // TODO: Used by memlat benchmark, should be disabled on a release version
 #define MEMLAT_SUPPORT
 
+#define CACHE_LINE_SIZE 64
+
+// epochs between two adjustments of a thread's epoch durations
+#define ADAPT_WINDOW_EPOCHS 16
+#define DEFAULT_OVERHEAD_BUDGET_PERCENT 5
+#define DEFAULT_EPOCH_DELAY_TARGET_US 100
+
+// default registry capacity, see latency.max_threads
+#define DEFAULT_MAX_THREADS 1024
+
+// signals sent to self at startup to measure the cost of a signal
+#define SIGNAL_CALIBRATION_ROUNDS 16
+
+// what closes the epochs that are not closed by synchronization, see latency.epoch_trigger
+#define EPOCH_TRIGGER_TIME 0 // max_epoch_duration_us, by a timer or the monitor thread
+#define EPOCH_TRIGGER_LLC_MISSES 1
+#define EPOCH_TRIGGER_INSTRUCTIONS 2
+#define EPOCH_TRIGGER_TASK_CLOCK 3 // software event, nanoseconds of CPU time of the thread
+#define DEFAULT_EPOCH_TRIGGER_MISSES 10000
+#define DEFAULT_EPOCH_TRIGGER_INSTRUCTIONS 10000000
+
+// Reads the time stamp counter. The epoch machinery uses the TSC for all its
+// timestamps, including the ones compared across threads by the monitor, so it
+// requires an invariant TSC synchronized among processors.
+static inline hrtime_t hrtime_now(void)
+{
+    unsigned hi, lo;
+    __asm__ __volatile__ ("rdtscp" : "=a"(lo), "=d"(hi) :: "rcx");
+    return ( (hrtime_t)lo)|( ((hrtime_t)hi)<<32 );
+}
+
 typedef struct thread_s {
-    struct virtual_node_s* virtual_node;
+    // fields read or written on every epoch and by the monitor thread, kept
+    // on their own cache line
+    volatile int signaled;
+    volatile int in_epoch; // set while the thread creates an epoch, replaces signal masking
+    int cpu_id; // the processor the thread is bound on
+    int heap_index; // position in the monitor deadline heap, -1 when not in it
+    hrtime_t last_epoch_timestamp; // TSC
+    hrtime_t monitor_deadline; // TSC the monitor checks this thread next, may lag last_epoch_timestamp
+    uint64_t read_delay_ratio; // (target-hw)/hw with DELAY_RATIO_SHIFT fractional bits
+    hrtime_t max_epoch_cycles; // this thread's epoch durations, adapted when latency.adaptive_epochs is set
+    hrtime_t min_epoch_cycles;
+    volatile hrtime_t signal_timestamp; // TSC the monitor signaled this thread at, 0 when no signal is pending
+
+    struct virtual_node_s* virtual_node __attribute__((aligned(CACHE_LINE_SIZE)));
     pthread_t pthread;
     pid_t tid;
-    int cpu_id; // the processor the thread is bound on
     int cpu_speed_mhz;
     struct thread_manager_s* thread_manager;
-    struct thread_s* next;
-    int signaled;
+    struct thread_pool_s* pool; // the pool the descriptor is recycled to
+    uint32_t pool_index; // descriptor index in its pool, never changes
+    uint32_t next_free; // pool free list link
+    int registry_slot;
+    timer_t epoch_timer; // fires SIGUSR1 at this thread when its epoch reaches the max duration
+    int has_epoch_timer; // threads without a timer are interrupted by the monitor thread
+    int has_epoch_counter; // epochs close on overflows of a counter instead of on time
+    int epoch_counter_fd;
+    int adapt_epochs; // epochs in the current adaptation window
+    uint64_t adapt_overhead_cycles;
+    uint64_t adapt_delay_cycles;
+    struct epoch_log_s* epoch_log; // epoch recorder, NULL unless latency.epoch_log is set
+    struct read_sampler_s* read_sampler; // LLC miss address sampler, NULL unless latency.read_buffer_blocks is set
+    uint64_t random_state; // xorshift state, samples the read latency distribution
+    volatile hrtime_t virtual_time_offset; // TSC cycles the clocks of this thread are ahead by, see latency.virtual_time
 #ifdef MEMLAT_SUPPORT
 	uint64_t stall_cycles;
 #endif
+    // written on every epoch by this thread only, apart from the neighbours' fields
+    pmc_thread_t pmc __attribute__((aligned(CACHE_LINE_SIZE)));
 #ifdef USE_STATISTICS
-    thread_stats_t stats;
-#else
-    double last_epoch_timestamp;
+    thread_stats_t stats __attribute__((aligned(CACHE_LINE_SIZE)));
+    uint64_t sweep_delay_ratio[MAX_SWEEP_LATENCIES]; // read_delay_ratio of each latency.sweep target
 #endif
-} thread_t;
+} __attribute__((aligned(CACHE_LINE_SIZE))) thread_t;
+
+typedef struct {
+    int virtual_node_id;
+    int cpu_id;
+} cpu_assignment_t;
 
 typedef struct thread_manager_s {
-    pthread_mutex_t mutex;
-    thread_t* thread_list;
+    pthread_mutex_t mutex; // protects the deadline heap and the round-robin policy state
+    thread_registry_t registry; // running threads
+    int max_threads;
     int max_epoch_duration_us; // maximum epoch duration in microseconds
     int min_epoch_duration_us; // minimum epoch duration in microseconds
+    hrtime_t max_epoch_duration_cycles; // same as above in TSC cycles
+    hrtime_t min_epoch_duration_cycles;
+    int adaptive_epochs; // adapt each thread's epoch durations within the bounds above
+    int overhead_budget_percent; // epochs get longer when overhead exceeds this share of the delay
+    hrtime_t epoch_delay_target_cycles; // epochs get shorter when they inject more delay than this
+    int tsc_mhz; // TSC cycles per microsecond
+    int per_thread_timers; // interrupt threads through their own timer instead of the monitor thread
+    int epoch_trigger;
+    uint64_t epoch_trigger_period; // events between two overflows of the epoch counter
+    hrtime_t signal_delivery_cycles; // from sending a signal to the handler, measured at startup
+    hrtime_t signal_return_cycles; // from the end of the handler back to the interrupted code
+    int monitor_started;
+    pthread_cond_t monitor_cond; // wakes the monitor up when a thread joins the deadline heap
+    thread_t** deadline_heap; // min-heap on monitor_deadline of the threads without an epoch timer
+    int deadline_heap_size;
+    int deadline_heap_capacity;
     int next_virtual_node_id; // used by the round-robin policy -- next virtual node to run on 
     int next_cpu_id; // used by the round-robin policy -- next cpu to run on
+    struct thread_pool_s* thread_pools; // thread descriptors, one pool per virtual node
+    cpu_assignment_t* cpu_ring; // the round-robin sequence from the current position, one entry per cpu
+    int cpu_ring_size;
+    volatile unsigned int next_cpu_ticket; // index of the next registered thread in cpu_ring
     struct virtual_topology_s* virtual_topology;   
 #ifdef USE_STATISTICS
     stats_t stats;
@@ -68,7 +158,8 @@ int register_self();
 int unregister_self();
 thread_t* thread_self();
 int reached_min_epoch_duration(thread_t* thread);
-void block_new_epoch();
-void unblock_new_epoch();
+void adapt_epoch_duration(thread_t* thread, uint64_t overhead_cycles, uint64_t delay_cycles);
+int tsc_mhz();
+thread_manager_t* get_thread_manager();
 
 #endif /* __THREAD_H */
@@ -0,0 +1,124 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.  
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <string.h>
+#include <numa.h>
+#include "error.h"
+#include "thread_pool.h"
+
+static inline thread_t* thread_pool_descriptor(thread_pool_t* pool, uint32_t index)
+{
+    return &pool->slabs[index / THREAD_SLAB_SIZE][index % THREAD_SLAB_SIZE];
+}
+
+int thread_pool_init(thread_pool_t* pool, int node_id)
+{
+    memset(pool, 0, sizeof(thread_pool_t));
+    pool->node_id = node_id;
+#ifdef USE_STATISTICS
+    stats_init_summary(&pool->terminated);
+#endif
+    return E_SUCCESS;
+}
+
+static void thread_pool_push(thread_pool_t* pool, thread_t* thread)
+{
+    uint64_t head;
+
+    do {
+        head = pool->free_head;
+        thread->next_free = (uint32_t) head;
+        __sync_synchronize();
+    } while (!__sync_bool_compare_and_swap(&pool->free_head, head, 
+                                           (head & 0xffffffff00000000ULL) | (thread->pool_index + 1)));
+}
+
+// The pop count in the upper half of free_head changes on every pop, so a
+// descriptor popped and pushed back between the read of its next_free link
+// and the compare-and-swap cannot be mistaken for an unchanged list.
+static thread_t* thread_pool_pop(thread_pool_t* pool)
+{
+    uint64_t head;
+    uint32_t index;
+    thread_t* thread;
+
+    do {
+        head = pool->free_head;
+        index = (uint32_t) head;
+        if (index == 0) {
+            return NULL;
+        }
+        thread = thread_pool_descriptor(pool, index - 1);
+    } while (!__sync_bool_compare_and_swap(&pool->free_head, head, 
+                                           (((head >> 32) + 1) << 32) | thread->next_free));
+
+    return thread;
+}
+
+// Adds a slab to the first empty slab entry. A thread losing the race for the
+// entry frees its slab and moves on to the next entry.
+static int thread_pool_grow(thread_pool_t* pool)
+{
+    int i, j;
+    thread_t* slab;
+    size_t size = THREAD_SLAB_SIZE * sizeof(thread_t);
+
+    for (i = 0; i < MAX_THREAD_SLABS; i++) {
+        if (pool->slabs[i]) {
+            continue;
+        }
+        if (!(slab = numa_alloc_onnode(size, pool->node_id))) {
+            return E_ERROR;
+        }
+        memset(slab, 0, size);
+        for (j = 0; j < THREAD_SLAB_SIZE; j++) {
+            slab[j].pool = pool;
+            slab[j].pool_index = i * THREAD_SLAB_SIZE + j;
+        }
+        if (!__sync_bool_compare_and_swap(&pool->slabs[i], NULL, slab)) {
+            numa_free(slab, size);
+            continue;
+        }
+        for (j = 0; j < THREAD_SLAB_SIZE; j++) {
+            thread_pool_push(pool, &slab[j]);
+        }
+        return E_SUCCESS;
+    }
+
+    return E_ERROR;
+}
+
+// Returns a zeroed descriptor, only its pool identity is kept
+thread_t* thread_pool_get(thread_pool_t* pool)
+{
+    thread_t* thread;
+    uint32_t pool_index;
+
+    while (!(thread = thread_pool_pop(pool))) {
+        if (thread_pool_grow(pool) != E_SUCCESS) {
+            DBG_LOG(WARNING, "cannot allocate thread descriptors on node %d\n", pool->node_id);
+            return NULL;
+        }
+    }
+
+    pool_index = thread->pool_index;
+    memset(thread, 0, sizeof(thread_t));
+    thread->pool = pool;
+    thread->pool_index = pool_index;
+    return thread;
+}
+
+void thread_pool_put(thread_pool_t* pool, thread_t* thread)
+{
+    thread_pool_push(pool, thread);
+}
@@ -0,0 +1,40 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.  
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#ifndef __THREAD_POOL_H
+#define __THREAD_POOL_H
+
+#include <stdint.h>
+#include "thread.h"
+
+#define THREAD_SLAB_SIZE 64 // descriptors per slab
+#define MAX_THREAD_SLABS 1024
+
+// Type-stable pool of thread descriptors allocated in slabs on the memory node
+// the threads of a virtual node run on. Descriptors are never returned to the
+// system, so a descriptor read by a concurrent scanner stays valid memory even
+// after its thread terminated.
+typedef struct thread_pool_s {
+    int node_id; // physical node the slabs are allocated on
+    volatile uint64_t free_head; // pop count << 32 | (index + 1) of the first free descriptor, 0 if empty
+    thread_t* volatile slabs[MAX_THREAD_SLABS];
+#ifdef USE_STATISTICS
+    thread_stats_summary_t terminated; // threads of this virtual node that terminated
+#endif
+} thread_pool_t;
+
+int thread_pool_init(thread_pool_t* pool, int node_id);
+thread_t* thread_pool_get(thread_pool_t* pool);
+void thread_pool_put(thread_pool_t* pool, thread_t* thread);
+
+#endif /* __THREAD_POOL_H */
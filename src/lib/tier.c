@@ -0,0 +1,86 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.  
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include "errno.h"
+#include "tier.h"
+
+static tier_region_t tier_regions[MAX_TIER_REGIONS];
+// slots above this one have never been used, lookups stop there
+static volatile int tier_regions_high = 0;
+// addresses every region ever added lies between, lookups outside stop early
+static volatile uintptr_t tier_regions_lowest = UINTPTR_MAX;
+static volatile uintptr_t tier_regions_highest = 0;
+// slot of the last region found by the thread, accesses tend to stay in one
+static __thread int tls_last_region = 0;
+
+int tier_add_region(void* start, size_t size, int tier)
+{
+    int i, high;
+    uintptr_t bound;
+
+    for (i = 0; i < MAX_TIER_REGIONS; i++) {
+        if (!tier_regions[i].claimed && __sync_bool_compare_and_swap(&tier_regions[i].claimed, 0, 1)) {
+            tier_regions[i].end = (uintptr_t) start + size;
+            tier_regions[i].tier = tier;
+            while ((bound = tier_regions_lowest) > (uintptr_t) start &&
+                   !__sync_bool_compare_and_swap(&tier_regions_lowest, bound, (uintptr_t) start));
+            while ((bound = tier_regions_highest) < (uintptr_t) start + size &&
+                   !__sync_bool_compare_and_swap(&tier_regions_highest, bound, (uintptr_t) start + size));
+            __sync_synchronize();
+            tier_regions[i].start = (uintptr_t) start;
+            while ((high = tier_regions_high) <= i && !__sync_bool_compare_and_swap(&tier_regions_high, high, i + 1));
+            return E_SUCCESS;
+        }
+    }
+    return E_NOMEM;
+}
+
+// Returns the tier of the region starting at start, -1 if there is none
+int tier_remove_region(void* start)
+{
+    int i, tier;
+
+    for (i = 0; i < tier_regions_high; i++) {
+        if (tier_regions[i].start == (uintptr_t) start) {
+            tier = tier_regions[i].tier;
+            tier_regions[i].start = 0;
+            __sync_synchronize();
+            tier_regions[i].claimed = 0;
+            return tier;
+        }
+    }
+    return -1;
+}
+
+// Returns the tier addr was allocated from, -1 outside the tiers
+int tier_of_address(uintptr_t addr)
+{
+    int i, n = tier_regions_high;
+    uintptr_t start;
+
+    if (addr < tier_regions_lowest || addr >= tier_regions_highest) {
+        return -1;
+    }
+    start = tier_regions[tls_last_region].start;
+    if (start && addr >= start && addr < tier_regions[tls_last_region].end) {
+        return tier_regions[tls_last_region].tier;
+    }
+    for (i = 0; i < n; i++) {
+        start = tier_regions[i].start;
+        if (start && addr >= start && addr < tier_regions[i].end) {
+            tls_last_region = i;
+            return tier_regions[i].tier;
+        }
+    }
+    return -1;
+}
@@ -11,34 +11,34 @@ should have received a copy of the GNU General Public License along
 with this program; if not, write to the Free Software Foundation,
 Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
 ***************************************************************************/
-#ifndef __CPU_PMC_H
-#define __CPU_PMC_H
-
-#include <stdint.h>
-
-
-// Usually the architectures support up to 4 counters enabled at the same
-// time per core when HT is enabled
-#define MAX_NUM_EVENTS 4
-
-typedef uint64_t (*read_stalls_t)(void);
-
-typedef struct {
-	const char **native_events;
-	read_stalls_t read_stalls_events_local;
-	read_stalls_t read_stalls_events_remote;
-} pmc_event_t;
-
-int pmc_init();
-void pmc_shutdown();
-int pmc_create_event_set_local_thread();
-void pmc_destroy_event_set_local_thread();
-int pmc_register_event_local_thread(const char *event_name);
-int pmc_events_start_local_thread();
-void pmc_events_stop_local_thread();
-int pmc_events_read_local_thread(long long *values);
-
-int pmc_register_thread();
-int pmc_unregister_thread();
-
-#endif /* __CPU_PMC_H */
+#ifndef __TIER_H
+#define __TIER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * \file
+ *
+ * Address ranges allocated from the memory tiers of latency.tiers by
+ * pmalloc_tier(). Sampled miss addresses are looked up in them at the end of
+ * the epochs, possibly from the epoch signal handler, so the table is lock
+ * free: a slot is claimed with a compare and swap and published by writing
+ * its start address last.
+ */
+
+// allocations from the tiers tracked at once
+#define MAX_TIER_REGIONS 1024
+
+typedef struct {
+    volatile uintptr_t start; // 0 when the slot is free
+    uintptr_t end;
+    int tier;
+    volatile int claimed;
+} tier_region_t;
+
+int tier_add_region(void* start, size_t size, int tier);
+int tier_remove_region(void* start);
+int tier_of_address(uintptr_t addr);
+
+#endif /* __TIER_H */
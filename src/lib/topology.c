@@ -90,6 +90,11 @@ int get_mc_pci_bus_list(pci_regs_t *bus_id_list[], int max_list_size, int* dev_c
     int   channel = 0;
     char  dontcare[512];
     int   dev_count = 0;
+    int   ret;
+
+    if ((ret = dev_mc_pci_bus_list(bus_id_list, max_list_size, dev_countp)) != E_NOENT) {
+        return ret;
+    }
 
     fp = popen("lspci", "r");
     if (fp == NULL) {
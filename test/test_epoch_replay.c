@@ -0,0 +1,203 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.  
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <libconfig.h>
+#include "cpu/cpu.h"
+#include "cpu/pmc.h"
+#include "epoch_log.h"
+#include "errno.h"
+#include "model.h"
+#include "model_lat.h"
+#include "sim.h"
+#include "thread.h"
+
+// Records epochs of the simulated counters with the epoch log of the
+// emulator, replays the log with the epoch_replay tool given as argument and
+// checks that the delays match: at the recorded latencies the replay must
+// give back the recorded delays, at another read latency the delays the
+// model computes for it.
+
+#define SCRIPT_PATH "/tmp/test_epoch_replay.pmc"
+#define LOG_PREFIX "/tmp/test_epoch_replay.log"
+#define TID 1
+#define EPOCHS 64
+#define CPU_SPEED_MHZ 2000
+#define HW_LATENCY 100
+#define READ_LATENCY 400
+#define WRITE_LATENCY 600
+#define SWEEP_LATENCY 800
+
+// Runs the tool on the log and returns the delay in usecs of the first line
+// it prints with the given prefix
+static int replay_delay_us(const char* replay, const char* args, const char* prefix, uint64_t* delay_us)
+{
+    char cmd[4096];
+    char line[1024];
+    char* p;
+    FILE* fp;
+    int found = 0;
+
+    snprintf(cmd, sizeof(cmd), "%s %s %s.%d", replay, args, LOG_PREFIX, TID);
+    if (!(fp = popen(cmd, "r"))) {
+        return 1;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        fputs(line, stdout);
+        if (!found && (p = strstr(line, prefix)) && (p = strchr(p, ':'))) {
+            found = sscanf(p, ": delay %lu", delay_us) == 1 || sscanf(p, ": %lu", delay_us) == 1;
+        }
+    }
+    return pclose(fp) != 0 || !found;
+}
+
+// Whether the tool refuses the arguments
+static int replay_rejects(const char* replay, const char* args)
+{
+    char cmd[4096];
+
+    snprintf(cmd, sizeof(cmd), "%s %s %s.%d >/dev/null 2>&1", replay, args, LOG_PREFIX, TID);
+    return system(cmd) != 0;
+}
+
+static int check(const char* name, uint64_t value, uint64_t expected)
+{
+    printf("%s: %llu, expected %llu\n", name, (unsigned long long) value, (unsigned long long) expected);
+    return value == expected ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+    config_t cfg;
+    cpu_model_t* cpu;
+    pmc_events_t* events;
+    thread_manager_t manager;
+    physical_node_t node;
+    virtual_node_t virtual_node;
+    thread_t thread;
+    epoch_record_t record;
+    uint64_t stall_cycles, writebacks, mlp;
+    uint64_t recorded_cycles = 0, sweep_cycles = 0;
+    uint64_t recorded_us, sweep_us;
+    char args[64];
+    int i, failures = 0;
+    FILE* fp;
+
+    if (argc != 2) {
+        printf("usage: %s epoch_replay\n", argv[0]);
+        return 1;
+    }
+
+    // the counts change from epoch to epoch so that rounding differences add up
+    if (!(fp = fopen(SCRIPT_PATH, "w"))) {
+        return 1;
+    }
+    for (i = 1; i <= 8; i++) {
+        fprintf(fp, "CYCLE_ACTIVITY:STALLS_L2_PENDING=%d MEM_LOAD_UOPS_LLC_HIT_RETIRED:XSNP_NONE=%d "
+                "MEM_LOAD_UOPS_LLC_MISS_RETIRED:LOCAL_DRAM=%d L2_LINES_OUT:DIRTY_ALL=%d "
+                "OFFCORE_REQUESTS_OUTSTANDING:DEMAND_DATA_RD=%d "
+                "OFFCORE_REQUESTS_OUTSTANDING:CYCLES_WITH_DEMAND_DATA_RD=%d\n",
+                1000003 * i, 20011 * i, 7919 * i + 13, 1009 * (9 - i), 700001 * i, 300007 * i);
+    }
+    fclose(fp);
+
+    setenv("NVMEMUL_SIMULATION_ENABLE", "1", 1);
+    setenv("NVMEMUL_SIMULATION_PMC_SCRIPT", SCRIPT_PATH, 1);
+    config_init(&cfg);
+    if (init_simulation(&cfg) != E_SUCCESS || !(cpu = cpu_model_by_name("Ivy Bridge Xeon"))) {
+        printf("cannot simulate an Ivy Bridge Xeon\n");
+        return 1;
+    }
+
+    // the simulated PMU has as many counters as the model needs
+    events = cpu->pmc_events;
+    events->num_avail_hw_cntrs = PMC_MAX_HW_CNTRS;
+    latency_model.read_latency = READ_LATENCY;
+    latency_model.write_latency = WRITE_LATENCY;
+    latency_model.pmc_events = events;
+    if (pmc_set_backend(events, SIM_PMC_BACKEND) != E_SUCCESS ||
+            !(latency_model.pmc_stall_cycles = enable_pmc_event(cpu, "ldm_stall_cycles")) ||
+            !(latency_model.pmc_dram_writebacks = enable_pmc_event(cpu, "dram_writebacks")) ||
+            !(latency_model.pmc_memory_parallelism = enable_pmc_event(cpu, "memory_parallelism")) ||
+            epoch_log_init(LOG_PREFIX, cpu) != E_SUCCESS) {
+        printf("cannot enable the simulated events\n");
+        return 1;
+    }
+
+    // one thread on a virtual node whose NVM is its DRAM
+    memset(&manager, 0, sizeof(manager));
+    memset(&node, 0, sizeof(node));
+    memset(&thread, 0, sizeof(thread));
+    manager.tsc_mhz = CPU_SPEED_MHZ;
+    node.latency = HW_LATENCY;
+    virtual_node.node_id = 0;
+    virtual_node.dram_node = &node;
+    virtual_node.nvram_node = &node;
+    thread.tid = TID;
+    thread.cpu_speed_mhz = CPU_SPEED_MHZ;
+    thread.virtual_node = &virtual_node;
+    thread.thread_manager = &manager;
+    init_thread_latency_model(&thread);
+    if (pmc_open_thread(events, &thread.pmc, 0) != E_SUCCESS || epoch_log_open(&thread) != E_SUCCESS) {
+        printf("cannot open the epoch log\n");
+        return 1;
+    }
+
+    // same steps as create_latency_epoch(), after the baseline snapshot
+    read_pmc_snapshot(events, &thread.pmc);
+    memset(tls_counter_diffs, 0, sizeof(tls_counter_diffs));
+    for (i = 0; i < EPOCHS; i++) {
+        read_pmc_snapshot(events, &thread.pmc);
+        stall_cycles = read_pmc_event(latency_model.pmc_stall_cycles);
+        mlp = read_pmc_event(latency_model.pmc_memory_parallelism);
+        writebacks = read_pmc_event(latency_model.pmc_dram_writebacks);
+
+        memset(&record, 0, sizeof(record));
+        record.start = i * 1000;
+        record.end = i * 1000 + 500;
+        memcpy(record.counter_diffs, tls_counter_diffs, sizeof(record.counter_diffs));
+        record.stall_cycles = stall_cycles;
+        record.writebacks = writebacks;
+        record.memory_parallelism = mlp;
+        record.delay_cycles = overlapped_delay_cycles(read_delay_cycles(stall_cycles, thread.read_delay_ratio), mlp) +
+                writebacks * write_delay_cycles_per_line(CPU_SPEED_MHZ, WRITE_LATENCY, HW_LATENCY);
+        epoch_log_append(&thread, &record);
+
+        recorded_cycles += record.delay_cycles;
+        sweep_cycles += read_delay_cycles(stall_cycles, delay_ratio(SWEEP_LATENCY, HW_LATENCY)) +
+                writebacks * write_delay_cycles_per_line(CPU_SPEED_MHZ, WRITE_LATENCY, HW_LATENCY);
+    }
+    epoch_log_close(&thread);
+    pmc_close_thread(events, &thread.pmc);
+    pmc_shutdown(events);
+
+    failures += check("delays recorded", recorded_cycles > 0, 1);
+    failures += replay_delay_us(argv[1], "", "recorded delay", &recorded_us);
+    failures += check("recorded delay", recorded_us, recorded_cycles / CPU_SPEED_MHZ);
+    failures += replay_delay_us(argv[1], "", "ns write", &recorded_us);
+    failures += check("replayed delay", recorded_us, recorded_cycles / CPU_SPEED_MHZ);
+    snprintf(args, sizeof(args), "-r %d -m off", SWEEP_LATENCY);
+    failures += replay_delay_us(argv[1], args, "ns write", &sweep_us);
+    failures += check("replayed delay at another latency", sweep_us, sweep_cycles / CPU_SPEED_MHZ);
+
+    failures += check("rejects -w 12x", replay_rejects(argv[1], "-w 12x"), 1);
+    failures += check("rejects -m yes", replay_rejects(argv[1], "-m yes"), 1);
+
+    remove(SCRIPT_PATH);
+    snprintf(args, sizeof(args), "%s.%d", LOG_PREFIX, TID);
+    remove(args);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,83 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.  
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <stdio.h>
+#include <stdint.h>
+#include "read_buffer.h"
+
+// Feeds synthetic miss address streams to the read buffer model, as the
+// sampler would, and checks the hit ratios they get.
+
+#define MEDIA_BLOCK_BYTES 256
+#define BUFFER_BLOCKS 64
+#define LINE_BYTES 64
+#define BASE 0x7f0000000000ULL
+
+static read_buffer_t buffer;
+
+static double hit_ratio(uint64_t start, uint64_t stride, uint64_t count, int passes)
+{
+    uint64_t i, hits = 0;
+    int pass;
+
+    read_buffer_init(&buffer, BUFFER_BLOCKS, MEDIA_BLOCK_BYTES);
+    for (pass = 0; pass < passes; pass++) {
+        for (i = 0; i < count; i++) {
+            hits += read_buffer_access(&buffer, start + i * stride);
+        }
+    }
+    return (double) hits / (count * passes);
+}
+
+static double random_hit_ratio(uint64_t range, uint64_t count)
+{
+    uint64_t i, hits = 0;
+    uint64_t x = 88172645463325252ULL;
+
+    read_buffer_init(&buffer, BUFFER_BLOCKS, MEDIA_BLOCK_BYTES);
+    for (i = 0; i < count; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        hits += read_buffer_access(&buffer, BASE + (x % range) / LINE_BYTES * LINE_BYTES);
+    }
+    return (double) hits / count;
+}
+
+static int check(const char* name, double ratio, double min, double max)
+{
+    printf("%s: hit ratio %.3f, expected [%.3f, %.3f]\n", name, ratio, min, max);
+    return ratio >= min && ratio <= max ? 0 : 1;
+}
+
+int main()
+{
+    int failures = 0;
+
+    // a sequential scan misses once per media block
+    failures += check("sequential", hit_ratio(BASE, LINE_BYTES, 1 << 16, 1), 0.74, 0.76);
+    // a stride of a media block never comes back to one
+    failures += check("stride 256", hit_ratio(BASE, MEDIA_BLOCK_BYTES, 1 << 16, 1), 0.0, 0.0);
+    // a strided working set that fits is only missed by the first pass
+    failures += check("stride 4096 fitting", hit_ratio(BASE, 4096, BUFFER_BLOCKS, 4), 0.74, 0.76);
+    // one block more than the buffer holds always misses with LRU
+    failures += check("stride 4096 thrashing", hit_ratio(BASE, 4096, BUFFER_BLOCKS + 1, 4), 0.0, 0.0);
+    // random misses over 1 GB almost never find their block
+    failures += check("random", random_hit_ratio(1ULL << 30, 1 << 16), 0.0, 0.01);
+    // the same block again
+    read_buffer_init(&buffer, BUFFER_BLOCKS, MEDIA_BLOCK_BYTES);
+    read_buffer_access(&buffer, BASE);
+    failures += check("same block", read_buffer_access(&buffer, BASE + MEDIA_BLOCK_BYTES - 1), 1.0, 1.0);
+
+    return failures ? 1 : 0;
+}
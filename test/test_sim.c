@@ -0,0 +1,183 @@
+/***************************************************************************
+Copyright 2016 Hewlett Packard Enterprise Development LP.  
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or (at
+your option) any later version. This program is distributed in the
+hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+PURPOSE. See the GNU General Public License for more details. You
+should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation,
+Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <libconfig.h>
+#include "cpu/cpu.h"
+#include "cpu/pmc.h"
+#include "errno.h"
+#include "measure.h"
+#include "sim.h"
+#include "thread.h"
+
+// Drives the simulated device and counters without any hardware: the read
+// bandwidth must follow the throttle level written through the cpu model,
+// the counters must replay the script line by line, and multiplexed counters
+// must be estimated in the epochs their set does not count.
+
+#define SCRIPT_PATH "/tmp/test_sim.pmc"
+#define STALLS "CYCLE_ACTIVITY:STALLS_L2_PENDING"
+#define MISSES "MEM_LOAD_UOPS_LLC_MISS_RETIRED:LOCAL_DRAM"
+#define HSW_HITS "MEM_LOAD_UOPS_L3_HIT_RETIRED:XSNP_NONE"
+#define HSW_MISSES "MEM_LOAD_UOPS_L3_MISS_RETIRED:LOCAL_DRAM"
+// epochs of the multiplexing check, long enough for their durations to match
+#define EPOCH_CYCLES 4000000ULL
+
+static int check(const char* name, uint64_t value, uint64_t expected)
+{
+    printf("%s: %llu, expected %llu\n", name, (unsigned long long) value, (unsigned long long) expected);
+    return value == expected ? 0 : 1;
+}
+
+static int check_range(const char* name, uint64_t value, uint64_t min, uint64_t max)
+{
+    printf("%s: %llu, expected [%llu, %llu]\n", name, (unsigned long long) value,
+           (unsigned long long) min, (unsigned long long) max);
+    return value >= min && value <= max ? 0 : 1;
+}
+
+static int check_bandwidth(cpu_model_t* cpu)
+{
+    pci_regs_t* regs[MAX_NUM_MC_PCI_BUS];
+    int dev_count;
+    int failures = 0;
+
+    if (dev_mc_pci_bus_list(regs, MAX_NUM_MC_PCI_BUS, &dev_count) != E_SUCCESS || dev_count < 1) {
+        printf("no simulated memory-controller bus\n");
+        return 1;
+    }
+
+    failures += check("unthrottled", (uint64_t) measure_read_bw(0, 0), 5000);
+    cpu->set_throttle_register(regs[0], THROTTLE_DDR_ACT, 0x800f);
+    failures += check("level 15", (uint64_t) measure_read_bw(0, 0), 1000);
+    cpu->set_throttle_register(regs[0], THROTTLE_DDR_ACT, 0x800f + 500);
+    failures += check("level 515", (uint64_t) measure_read_bw(0, 0), 3000);
+    cpu->set_throttle_register(regs[0], THROTTLE_DDR_ACT, 0x8fff);
+    failures += check("reset", (uint64_t) measure_read_bw(0, 0), 5000);
+    return failures;
+}
+
+static int check_script(cpu_model_t* cpu)
+{
+    pmc_events_t* events = cpu->pmc_events;
+    pmc_hw_event_t* stalls;
+    pmc_hw_event_t* misses;
+    pmc_thread_t thread = {{0}};
+    uint64_t expected[][2] = {{0, 0}, {1000, 10}, {3000, 0}, {1000, 10}};
+    int i, failures = 0;
+    FILE* fp;
+
+    if (!(fp = fopen(SCRIPT_PATH, "w"))) {
+        return 1;
+    }
+    fprintf(fp, "# stalls and misses of each epoch\n");
+    fprintf(fp, "%s=1000 %s=10\n\n", STALLS, MISSES);
+    fprintf(fp, "%s=3000 # no miss\n", STALLS);
+    fclose(fp);
+
+    if (pmc_set_backend(events, SIM_PMC_BACKEND) != E_SUCCESS ||
+            !(stalls = enable_pmc_hw_event(events, STALLS)) ||
+            !(misses = enable_pmc_hw_event(events, MISSES)) ||
+            pmc_open_thread(events, &thread, 0) != E_SUCCESS) {
+        printf("cannot open the simulated counters\n");
+        return 1;
+    }
+
+    // the first snapshot is the baseline, then the script loops
+    for (i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+        read_pmc_snapshot(events, &thread);
+        failures += check("stalls", tls_pmc_snapshot.diffs[stalls->hw_cntr_id], expected[i][0]);
+        failures += check("misses", tls_pmc_snapshot.diffs[misses->hw_cntr_id], expected[i][1]);
+    }
+
+    pmc_close_thread(events, &thread);
+    pmc_shutdown(events);
+    remove(SCRIPT_PATH);
+    return failures;
+}
+
+// Two counters, the stall cycles pinned and the hits and misses taking turns
+// on the other one. Every epoch has the same counts in the script.
+static int check_multiplex()
+{
+    cpu_model_t* cpu = cpu_model_by_name("Haswell Xeon");
+    pmc_events_t* events = cpu->pmc_events;
+    pmc_hw_event_t* stalls;
+    pmc_hw_event_t* hits;
+    pmc_hw_event_t* misses;
+    pmc_thread_t thread = {{0}};
+    hrtime_t start;
+    int i, failures = 0;
+    FILE* fp;
+
+    if (!(fp = fopen(SCRIPT_PATH, "w"))) {
+        return 1;
+    }
+    fprintf(fp, "%s=1000 %s=500 %s=100\n", STALLS, HSW_HITS, HSW_MISSES);
+    fclose(fp);
+
+    events->num_avail_hw_cntrs = 2;
+    if (pmc_set_backend(events, SIM_PMC_BACKEND) != E_SUCCESS ||
+            pmc_set_multiplex(events, 1) != E_SUCCESS ||
+            !(stalls = enable_pmc_hw_event(events, STALLS)) ||
+            !(hits = enable_pmc_hw_event(events, HSW_HITS)) ||
+            !(misses = enable_pmc_hw_event(events, HSW_MISSES)) ||
+            pmc_open_thread(events, &thread, 0) != E_SUCCESS) {
+        printf("cannot multiplex the simulated counters\n");
+        return 1;
+    }
+    failures += check("sets", events->num_hw_cntr_sets, 2);
+
+    // baseline, then one epoch for each set before any estimate
+    for (i = 0; i < 3; i++) {
+        for (start = hrtime_now(); hrtime_now() - start < EPOCH_CYCLES; );
+        read_pmc_snapshot(events, &thread);
+    }
+    for (i = 0; i < 4; i++) {
+        for (start = hrtime_now(); hrtime_now() - start < EPOCH_CYCLES; );
+        read_pmc_snapshot(events, &thread);
+        failures += check("pinned stalls", tls_pmc_snapshot.diffs[stalls->hw_cntr_id], 1000);
+        failures += check_range("hits", tls_pmc_snapshot.diffs[hits->hw_cntr_id], 250, 1000);
+        failures += check_range("misses", tls_pmc_snapshot.diffs[misses->hw_cntr_id], 50, 200);
+    }
+
+    pmc_close_thread(events, &thread);
+    pmc_shutdown(events);
+    remove(SCRIPT_PATH);
+    return failures;
+}
+
+int main()
+{
+    config_t cfg;
+    cpu_model_t* cpu;
+    int failures = 0;
+
+    setenv("NVMEMUL_SIMULATION_ENABLE", "1", 1);
+    setenv("NVMEMUL_SIMULATION_BANDWIDTH_CURVE", "15:1000,1015:5000", 1);
+    setenv("NVMEMUL_SIMULATION_PMC_SCRIPT", SCRIPT_PATH, 1);
+    config_init(&cfg);
+
+    if (init_simulation(&cfg) != E_SUCCESS || !(cpu = cpu_model_by_name("Ivy Bridge Xeon"))) {
+        printf("cannot simulate an Ivy Bridge Xeon\n");
+        return 1;
+    }
+
+    failures += check_bandwidth(cpu);
+    failures += check_script(cpu);
+    failures += check_multiplex();
+
+    return failures ? 1 : 0;
+}